@@ -1,7 +1,11 @@
+#include <limits.h>
 #include "builtin.h"
 #include "lenv.h"
 #include "lval.h"
-#include "rok.h"
+#include "lgc.h"
+#include "lmap.h"
+#include "lmemo.h"
+#include "lread.h"
 
 #define LASSERT(args, cond, fmt, ...) \
   if (!(cond)) { \
@@ -11,10 +15,10 @@
   }
 
 #define LASSERT_TYPE(func, args, index, expect) \
-  LASSERT(args, args->cell[index]->type == expect, \
+  LASSERT(args, lval_type(args->cell[index]) == expect, \
     "Function '%s' passed incorrect type for argument %i. " \
     "Got %s, Expected %s.", \
-    func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+    func, index, ltype_name(lval_type(args->cell[index])), ltype_name(expect))
 
 #define LASSERT_NUM(func, args, num) \
   LASSERT(args, args->count == num, \
@@ -29,40 +33,38 @@
 lval* builtin_op(lenv* env, lval* args, char* op) {
   /* Ensure all arguments are numbers */
   for (int i = 0; i < args->count; i++) {
-    if(args->cell[i]->type != LVAL_NUM) {
+    if(lval_type(args->cell[i]) != LVAL_NUM) {
       lval_del(args);
       return lval_err("Cannot operate on non-numbers");
     }
   }
 
-  /* Pop the first element */
-  lval* x = lval_pop(args, 0);
+  /* Start from the first element */
+  long x = lval_num_val(args->cell[0]);
 
   /* If no arguments and sub then perform unary negation */
-  if ((strcmp(op, "-") == 0) && args->count == 0) {
-    x->num = -x->num;
+  if ((strcmp(op, "-") == 0) && args->count == 1) {
+    x = -x;
   }
 
-  /* While there are still elements remaining */
-  while (args->count > 0) {
-    /* Pop the next element */
-    lval* y = lval_pop(args, 0);
+  /* Fold in each remaining element */
+  for (int i = 1; i < args->count; i++) {
+    long y = lval_num_val(args->cell[i]);
 
-    if(strcmp(op, "+") == 0) { x->num += y->num; }
-    if(strcmp(op, "-") == 0) { x->num -= y->num; }
-    if(strcmp(op, "*") == 0) { x->num *= y->num; }
+    if(strcmp(op, "+") == 0) { x += y; }
+    if(strcmp(op, "-") == 0) { x -= y; }
+    if(strcmp(op, "*") == 0) { x *= y; }
     if(strcmp(op, "/") == 0) {
-      if(y->num == 0) {
-        lval_del(x); lval_del(y);
-        x = lval_err("Division By Zero!"); break;
+      if(y == 0) {
+        lval_del(args);
+        return lval_err("Division By Zero!");
       }
-      x->num /= y->num;
+      x /= y;
     }
-    if(strcmp(op, "%") == 0) { x->num %= y->num; }
-    if(strcmp(op, "^") == 0) { x->num = (long)pow(x->num, y->num);}
-    lval_del(y);
+    if(strcmp(op, "%") == 0) { x %= y; }
+    if(strcmp(op, "^") == 0) { x = (long)pow(x, y);}
   }
-  lval_del(args); return x;
+  lval_del(args); return lval_num(x);
 }
 
 lval* builtin_add(lenv* env, lval* args) {
@@ -90,36 +92,14 @@ lval* builtin_order(lenv* env, lval* args, char* op) {
   LASSERT_TYPE(op, args, 0, LVAL_NUM);
   LASSERT_TYPE(op, args, 1, LVAL_NUM);
 
-  char* result = malloc(strlen("false") + 1);
+  long x = lval_num_val(args->cell[0]);
+  long y = lval_num_val(args->cell[1]);
+  int result = 0;
 
-  if(strcmp(op, ">") == 0) {
-    if(args->cell[0]->num > args->cell[1]->num) {
-      result = "true";
-    } else {
-      result = "false";
-    }
-  }
-  if(strcmp(op, ">=") == 0) {
-    if(args->cell[0]->num >= args->cell[1]->num) {
-      result = "true";
-    } else {
-      result = "false";
-    }
-  }
-  if(strcmp(op, "<") == 0) {
-    if(args->cell[0]->num < args->cell[1]->num) {
-      result = "true";
-    } else {
-      result = "false";
-    }
-  }
-  if(strcmp(op, "<=") == 0) {
-    if(args->cell[0]->num <= args->cell[1]->num) {
-      result = "true";
-    } else {
-      result = "false";
-    }
-  }
+  if(strcmp(op, ">") == 0) { result = x > y; }
+  if(strcmp(op, ">=") == 0) { result = x >= y; }
+  if(strcmp(op, "<") == 0) { result = x < y; }
+  if(strcmp(op, "<=") == 0) { result = x <= y; }
 
   lval_del(args);
   return lval_bool(result);
@@ -154,11 +134,7 @@ lval* builtin_compare(lenv* env, lval* args, char* op) {
   if (strcmp(op, "!=") == 0) {
     lval* result = lval_eq(args->cell[0], args->cell[1]);
     lval_del(args);
-    if (strcmp(result->bool, "true") == 0) {
-      return lval_bool("false");
-    } else {
-      return lval_bool("true");
-    }
+    return lval_bool(!lval_is_true(result));
   }
   return lval_err("Something went wrong with compare");
 }
@@ -177,18 +153,17 @@ lval* builtin_if(lenv* env, lval* args) {
   LASSERT_TYPE("if", args, 1, LVAL_QEXPR);
   LASSERT_TYPE("if", args, 2, LVAL_QEXPR);
 
-  /* Mark both expressions as evaluable */
-  lval* result;
-  args->cell[1]->type = LVAL_SEXPR;
-  args->cell[2]->type = LVAL_SEXPR;
-
-  if (strcmp(args->cell[0]->bool, "true") == 0) {
-    /* If condition evaluates true evaluate first expression */
-    result = lval_eval(env, lval_pop(args, 1));
+  /* If condition evaluates true take first expression, otherwise second */
+  lval* branch;
+  if (lval_is_true(args->cell[0])) {
+    branch = lval_unshare(lval_pop(args, 1));
   } else {
-    /* Otherwise eval second expression */
-    result = lval_eval(env, lval_pop(args, 2));
+    branch = lval_unshare(lval_pop(args, 2));
   }
+
+  /* Mark expression as evaluable and eval it */
+  branch->type = LVAL_SEXPR;
+  lval* result = lval_eval(env, branch);
   lval_del(args);
   return result;
 }
@@ -196,10 +171,10 @@ lval* builtin_if(lenv* env, lval* args) {
 lval* builtin_head(lenv* env, lval* args) {
   /* Check Error Conditions */
   int count = 1;
-  LASSERT(args, args->cell[0]->type == LVAL_QEXPR,
+  LASSERT(args, lval_type(args->cell[0]) == LVAL_QEXPR,
      "Function 'head' passed incorrect types! \n"
      "Got %s, Expected %s.",
-     ltype_name(args->cell[0]->type), ltype_name(LVAL_QEXPR));
+     ltype_name(lval_type(args->cell[0])), ltype_name(LVAL_QEXPR));
   LASSERT(args, args->cell[0]->count != 0,
    "Function 'head' passed {}!");
   LASSERT(args, args->count == count,
@@ -208,10 +183,11 @@ lval* builtin_head(lenv* env, lval* args) {
     args->count, 1);
 
   /* Otherwise take first argument */
-  lval* head = lval_take(args, 0);
+  lval* list = lval_take(args, 0);
 
-  /* Delete all elements that are not head and return */
-  while(head->count > 1) { lval_del(lval_pop(head, 1)); }
+  /* Only the first element goes into the new list */
+  lval* head = lval_add(lval_qexpr(), lval_copy(list->cell[0]));
+  lval_del(list);
   return head;
 }
 
@@ -221,18 +197,25 @@ lval* builtin_tail(lenv* env, lval* args) {
     "Function 'tail' passed too many arguments! \n"
     "Got %i, Expected %i",
     args->count, 1);
-  LASSERT(args, args->cell[0]->type == LVAL_QEXPR,
+  LASSERT(args, lval_type(args->cell[0]) == LVAL_QEXPR,
     "Function 'tail' passed incorrect types! \n"
     "Got %s, Expected %s",
-    ltype_name(args->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(args->cell[0])), ltype_name(LVAL_QEXPR));
   LASSERT(args, args->cell[0]->count != 0,
     "Function 'tail' passed {}!");
 
   /* Other wise take first arg */
-  lval* tail = lval_take(args, 0);
+  lval* list = lval_take(args, 0);
 
-  /* Delete first element and return */
-  lval_del(lval_pop(tail, 0));
+  /* Drop the first element in place if the list is ours alone */
+  if (list->refs == 1) {
+    lval_del(lval_pop(list, 0));
+    return list;
+  }
+
+  /* Otherwise view the rest of the shared list */
+  lval* tail = lval_slice(list, 1);
+  lval_del(list);
   return tail;
 }
 
@@ -246,21 +229,21 @@ lval* builtin_eval(lenv* env, lval* args) {
     "Function 'eval' passed too many arguments! \n"
     "Got %s, Expected %s",
     args->count, 1);
-  LASSERT(args, args->cell[0]->type == LVAL_QEXPR,
+  LASSERT(args, lval_type(args->cell[0]) == LVAL_QEXPR,
      "Function 'eval' passed incorrect type! \n"
      "Got %s, Expected %s",
-     ltype_name(args->cell[0]->type), ltype_name(LVAL_QEXPR));
-  lval* sexpr = lval_take(args, 0);
+     ltype_name(lval_type(args->cell[0])), ltype_name(LVAL_QEXPR));
+  lval* sexpr = lval_unshare(lval_take(args, 0));
   sexpr->type = LVAL_SEXPR;
   return lval_eval(env, sexpr);
 }
 
 lval* builtin_join(lenv* env, lval* args) {
   for(int i = 0; i < args->count; i++) {
-    LASSERT(args, args->cell[0]->type == LVAL_QEXPR,
+    LASSERT(args, lval_type(args->cell[0]) == LVAL_QEXPR,
       "Function 'join' passed incorrect types! \n"
       "Got %s, Expected %s",
-      ltype_name(args->cell[0]->type), ltype_name(LVAL_QEXPR));
+      ltype_name(lval_type(args->cell[0])), ltype_name(LVAL_QEXPR));
   }
 
   lval* joined_lval = lval_pop(args, 0);
@@ -275,7 +258,304 @@ lval* builtin_join(lenv* env, lval* args) {
 
 // Return the number of elements in a Qexpression
 lval* builtin_len(lenv* env, lval* args) {
-  return lval_num(args->cell[0]->count);
+  LASSERT_NUM("len", args, 1);
+  LASSERT_TYPE("len", args, 0, LVAL_QEXPR);
+
+  lval* len = lval_num(args->cell[0]->count);
+  lval_del(args);
+  return len;
+}
+
+/* Call fun on up to two values directly instead of evaluating an S-Expression */
+static lval* builtin_apply(lenv* env, lval* fun, lval* a, lval* b) {
+  lval* args = lval_sexpr();
+  lval_reserve(args, 2);
+  args->cell[args->count++] = a;
+  if (b) { args->cell[args->count++] = b; }
+  return lval_call(env, fun, args);
+}
+
+/* Count to use for an index clamped to the length of a list */
+static int builtin_clamp(lval* n, lval* list) {
+  long i = lval_num_val(n);
+  if (i < 0) { return 0; }
+  return i < list->count ? (int)i : list->count;
+}
+
+/* New list of the cells from index 'from' up to 'to' */
+static lval* builtin_range(lval* list, int from, int to) {
+  lval* x = lval_qexpr();
+  lval_reserve(x, to - from);
+  for (int i = from; i < to; i++) {
+    x->cell[x->count++] = lval_copy(list->cell[i]);
+  }
+  return x;
+}
+
+lval* builtin_nth(lenv* env, lval* args) {
+  LASSERT_NUM("nth", args, 2);
+  LASSERT_TYPE("nth", args, 0, LVAL_NUM);
+  LASSERT_TYPE("nth", args, 1, LVAL_QEXPR);
+
+  long n = lval_num_val(args->cell[0]);
+  LASSERT(args, n >= 0 && n < args->cell[1]->count,
+    "Function 'nth' passed index %li for a list of length %i.",
+    n, args->cell[1]->count);
+
+  lval* x = lval_copy(args->cell[1]->cell[n]);
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_last(lenv* env, lval* args) {
+  LASSERT_NUM("last", args, 1);
+  LASSERT_TYPE("last", args, 0, LVAL_QEXPR);
+  LASSERT_NOT_EMPTY("last", args, 0);
+
+  lval* list = args->cell[0];
+  lval* x = lval_copy(list->cell[list->count-1]);
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_take(lenv* env, lval* args) {
+  LASSERT_NUM("take", args, 2);
+  LASSERT_TYPE("take", args, 0, LVAL_NUM);
+  LASSERT_TYPE("take", args, 1, LVAL_QEXPR);
+
+  lval* list = args->cell[1];
+  lval* x = builtin_range(list, 0, builtin_clamp(args->cell[0], list));
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_drop(lenv* env, lval* args) {
+  LASSERT_NUM("drop", args, 2);
+  LASSERT_TYPE("drop", args, 0, LVAL_NUM);
+  LASSERT_TYPE("drop", args, 1, LVAL_QEXPR);
+
+  /* The rest of the list is shared rather than copied */
+  int n = builtin_clamp(args->cell[0], args->cell[1]);
+  lval* x = lval_slice(args->cell[1], n);
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_split(lenv* env, lval* args) {
+  LASSERT_NUM("split", args, 2);
+  LASSERT_TYPE("split", args, 0, LVAL_NUM);
+  LASSERT_TYPE("split", args, 1, LVAL_QEXPR);
+
+  lval* list = args->cell[1];
+  int n = builtin_clamp(args->cell[0], list);
+  lval* x = lval_qexpr();
+  x = lval_add(x, builtin_range(list, 0, n));
+  x = lval_add(x, lval_slice(list, n));
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_elem(lenv* env, lval* args) {
+  LASSERT_NUM("elem", args, 2);
+  LASSERT_TYPE("elem", args, 1, LVAL_QEXPR);
+
+  lval* list = args->cell[1];
+  int found = 0;
+  for (int i = 0; i < list->count && !found; i++) {
+    found = lval_is_true(lval_eq(args->cell[0], list->cell[i]));
+  }
+  lval_del(args);
+  return lval_bool(found);
+}
+
+lval* builtin_map(lenv* env, lval* args) {
+  LASSERT_NUM("map", args, 2);
+  LASSERT_TYPE("map", args, 0, LVAL_FUN);
+  LASSERT_TYPE("map", args, 1, LVAL_QEXPR);
+
+  lval* fun = args->cell[0];
+  lval* list = args->cell[1];
+  lval* x = lval_qexpr();
+  lval_reserve(x, list->count);
+
+  for (int i = 0; i < list->count; i++) {
+    lval* y = builtin_apply(env, fun, lval_copy(list->cell[i]), NULL);
+    if (lval_type(y) == LVAL_ERR) {
+      lval_del(x); lval_del(args);
+      return y;
+    }
+    x->cell[x->count++] = y;
+  }
+
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_filter(lenv* env, lval* args) {
+  LASSERT_NUM("filter", args, 2);
+  LASSERT_TYPE("filter", args, 0, LVAL_FUN);
+  LASSERT_TYPE("filter", args, 1, LVAL_QEXPR);
+
+  lval* fun = args->cell[0];
+  lval* list = args->cell[1];
+  lval* x = lval_qexpr();
+
+  for (int i = 0; i < list->count; i++) {
+    lval* keep = builtin_apply(env, fun, lval_copy(list->cell[i]), NULL);
+    if (lval_type(keep) == LVAL_ERR) {
+      lval_del(x); lval_del(args);
+      return keep;
+    }
+    if (lval_type(keep) != LVAL_BOOL) {
+      lval* err = lval_err(
+        "Function 'filter' passed a function returning %s, Expected %s.",
+        ltype_name(lval_type(keep)), ltype_name(LVAL_BOOL));
+      lval_del(keep); lval_del(x); lval_del(args);
+      return err;
+    }
+    if (lval_is_true(keep)) { x = lval_add(x, lval_copy(list->cell[i])); }
+  }
+
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_foldl(lenv* env, lval* args) {
+  LASSERT_NUM("foldl", args, 3);
+  LASSERT_TYPE("foldl", args, 0, LVAL_FUN);
+  LASSERT_TYPE("foldl", args, 2, LVAL_QEXPR);
+
+  lval* fun = args->cell[0];
+  lval* list = args->cell[2];
+  lval* z = lval_copy(args->cell[1]);
+
+  for (int i = 0; i < list->count; i++) {
+    z = builtin_apply(env, fun, z, lval_copy(list->cell[i]));
+    if (lval_type(z) == LVAL_ERR) { break; }
+  }
+
+  lval_del(args);
+  return z;
+}
+
+/* Fold a list of numbers with an arithmetic operator, starting from x */
+static lval* builtin_list_op(lenv* env, lval* args, char* func, char* op, long x) {
+  LASSERT_NUM(func, args, 1);
+  LASSERT_TYPE(func, args, 0, LVAL_QEXPR);
+
+  lval* nums = lval_add(lval_sexpr(), lval_num(x));
+  nums = lval_join(nums, lval_take(args, 0));
+  return builtin_op(env, nums, op);
+}
+
+lval* builtin_sum(lenv* env, lval* args) {
+  return builtin_list_op(env, args, "sum", "+", 0);
+}
+
+lval* builtin_product(lenv* env, lval* args) {
+  return builtin_list_op(env, args, "product", "*", 1);
+}
+
+/* New map with each key and value pair in args from index 'from' added to map */
+static lval* builtin_assoc_pairs(lval* map, lval* args, int from) {
+  lval* x = lval_map();
+  x->map = map->map ? lmap_retain(map->map) : NULL;
+  x->size = map->size;
+
+  for (int i = from; i < args->count; i += 2) {
+    int added = 0;
+    lnode* root = lmap_assoc(x->map, lval_hash(args->cell[i]),
+      args->cell[i], args->cell[i+1], &added);
+    if (x->map) { lmap_del(x->map); }
+    x->map = root;
+    x->size += added;
+  }
+  return x;
+}
+
+lval* builtin_hash_map(lenv* env, lval* args) {
+  LASSERT(args, args->count % 2 == 0,
+    "Function 'hash-map' passed a key without a value. "
+    "Got %i arguments, Expected an even number.", args->count);
+
+  lval* empty = lval_map();
+  lval* x = builtin_assoc_pairs(empty, args, 0);
+  lval_del(empty);
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_get(lenv* env, lval* args) {
+  LASSERT(args, args->count == 2 || args->count == 3,
+    "Function 'get' passed incorrect number of arguments. "
+    "Got %i, Expected 2 or 3.", args->count);
+  LASSERT_TYPE("get", args, 0, LVAL_MAP);
+
+  /* Missing keys give the default if there is one */
+  lval* map = args->cell[0];
+  lval* key = args->cell[1];
+  lval* val = map->map ? lmap_get(map->map, lval_hash(key), key) : NULL;
+  if (!val && args->count == 3) { val = args->cell[2]; }
+  LASSERT(args, val, "Function 'get' passed a key not in the map.");
+
+  val = lval_copy(val);
+  lval_del(args);
+  return val;
+}
+
+lval* builtin_assoc(lenv* env, lval* args) {
+  LASSERT(args, args->count >= 3 && args->count % 2 == 1,
+    "Function 'assoc' passed incorrect number of arguments. "
+    "Got %i, Expected a map followed by keys and values.", args->count);
+  LASSERT_TYPE("assoc", args, 0, LVAL_MAP);
+
+  lval* x = builtin_assoc_pairs(args->cell[0], args, 1);
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_dissoc(lenv* env, lval* args) {
+  LASSERT(args, args->count >= 1,
+    "Function 'dissoc' passed incorrect number of arguments. "
+    "Got %i, Expected at least 1.", args->count);
+  LASSERT_TYPE("dissoc", args, 0, LVAL_MAP);
+
+  lval* map = args->cell[0];
+  lval* x = lval_map();
+  x->map = map->map ? lmap_retain(map->map) : NULL;
+  x->size = map->size;
+
+  for (int i = 1; i < args->count && x->map; i++) {
+    int removed = 0;
+    lnode* root = lmap_dissoc(x->map, lval_hash(args->cell[i]), args->cell[i], &removed);
+    lmap_del(x->map);
+    x->map = root;
+    x->size -= removed;
+  }
+
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_keys(lenv* env, lval* args) {
+  LASSERT_NUM("keys", args, 1);
+  LASSERT_TYPE("keys", args, 0, LVAL_MAP);
+
+  lval* map = args->cell[0];
+  lval* x = lval_qexpr();
+  lval_reserve(x, map->size);
+  if (map->map) { x = lmap_keys(map->map, x); }
+  lval_del(args);
+  return x;
+}
+
+lval* builtin_count(lenv* env, lval* args) {
+  LASSERT_NUM("count", args, 1);
+  LASSERT_TYPE("count", args, 0, LVAL_MAP);
+
+  lval* x = lval_num(args->cell[0]->size);
+  lval_del(args);
+  return x;
 }
 
 // Define a new lambda
@@ -287,9 +567,9 @@ lval* builtin_lambda(lenv* env, lval* args) {
 
   /* Check if first Q-expression contains only symbols */
   for (int i = 0; i < args->cell[0]->count; i++) {
-    LASSERT(args, (args->cell[0]->cell[i]->type == LVAL_SYM),
+    LASSERT(args, (lval_type(args->cell[0]->cell[i]) == LVAL_SYM),
     "Cannot define non-symbol. Got %s, Expected %s.",
-    ltype_name(args->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+    ltype_name(lval_type(args->cell[0]->cell[i])), ltype_name(LVAL_SYM));
   }
 
   /* Pop first two arguments and pass them to lval_lambda */
@@ -299,6 +579,29 @@ lval* builtin_lambda(lenv* env, lval* args) {
   return lval_lambda(formals, body);
 }
 
+// Wrap a function with a cache of its results
+lval* builtin_memo(lenv* env, lval* args) {
+  LASSERT(args, args->count == 1 || args->count == 2,
+    "Function 'memo' passed incorrect number of arguments. "
+    "Got %i, Expected 1 or 2.", args->count);
+  LASSERT_TYPE("memo", args, 0, LVAL_FUN);
+
+  /* Optional number of results to keep */
+  int capacity = LMEMO_CAPACITY;
+  if (args->count == 2) {
+    LASSERT_TYPE("memo", args, 1, LVAL_NUM);
+    LASSERT(args, lval_num_val(args->cell[1]) > 0 && lval_num_val(args->cell[1]) <= INT_MAX,
+      "Function 'memo' passed an invalid capacity. "
+      "Got %li, Expected a positive number.", lval_num_val(args->cell[1]));
+    capacity = lval_num_val(args->cell[1]);
+  }
+
+  lval* x = lval_fun(NULL);
+  x->memo = lmemo_new(lval_copy(args->cell[0]), capacity);
+  lval_del(args);
+  return x;
+}
+
 lval* builtin_def(lenv* env, lval* args) {
   return builtin_var(env, args, "def");
 }
@@ -312,10 +615,10 @@ lval* builtin_var(lenv* env, lval* args, char* func) {
 
   lval* syms = args->cell[0];
   for (int i = 0; i < syms->count; i++) {
-    LASSERT(args, (syms->cell[i]->type == LVAL_SYM),
+    LASSERT(args, (lval_type(syms->cell[i]) == LVAL_SYM),
       "Function '%s' cannot define non-symbol. "
       "Got %s, Expected %s.", func,
-      ltype_name(syms->cell[i]->type),
+      ltype_name(lval_type(syms->cell[i])),
       ltype_name(LVAL_SYM));
   }
 
@@ -342,38 +645,43 @@ lval* builtin_load(lenv* env, lval* args) {
   LASSERT_NUM("load", args, 1);
   LASSERT_TYPE("load", args, 0, LVAL_STR);
 
-  /* Parse file given by string name */
-  mpc_result_t result;
-  if (mpc_parse_contents(args->cell[0]->str, Rok, &result)) {
-    /* Read contents */
-    lval* expr = lval_read(result.output);
-    mpc_ast_delete(result.output);
-    /* Evaluate each expression */
-    while (expr->count) {
-      lval* x = lval_eval(env, lval_pop(expr, 0));
-      if (x->type == LVAL_ERR) { lval_println(x); }
-      lval_del(x);
-    }
+  /* The reader holds on to the filename so args stays reachable */
+  lgc_push(args);
 
-    /* Delete expressions and arguments */
-    lval_del(expr);
+  /* Open file given by string name */
+  lreader r;
+  if (!lread_open(&r, args->cell[0]->str)) {
+    lgc_pop();
+    lval* err = lval_err("Could not get Library %s: error: Unable to open file!",
+      args->cell[0]->str);
     lval_del(args);
+    return err;
+  }
 
-    /* Return empty list */
-    return lval_sexpr();
-  } else {
-    /* Get Parse Error as String */
-    char* err_msg = mpc_err_string(result.error);
-    mpc_err_delete(result.error);
+  /* Evaluate each expression as soon as it is read */
+  lval* expr;
+  while ((expr = lread_next(&r))) {
+    /* Expressions before a syntax error have already run */
+    if (r.error) { break; }
 
-    /* Create new error with err message */
-    lval* err = lval_err("Could not get Library %s", err_msg);
+    lval* x = lval_eval(env, expr);
+    if (lval_type(x) == LVAL_ERR) { lval_println(x); }
+    lval_del(x);
+    lgc_safe_point(env);
+  }
+  lread_close(&r);
+  lgc_pop();
+  lval_del(args);
 
-    /* Clean up and return err */
-    free(err_msg);
-    lval_del(args);
+  /* Return the read error if there was one */
+  if (expr) {
+    lval* err = lval_err("Could not get Library %s", expr->err);
+    lval_del(expr);
     return err;
   }
+
+  /* Otherwise return empty list */
+  return lval_sexpr();
 }
 
 lval* builtin_print(lenv* env, lval* args) {
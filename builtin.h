@@ -25,7 +25,25 @@ lval* builtin_eval(struct lenv* env, lval* args);
 lval* builtin_join(struct lenv* env, lval* args);
 lval* builtin_def(struct lenv* env, lval* args);
 lval* builtin_len(struct lenv* env, lval* args);
+lval* builtin_nth(struct lenv* env, lval* args);
+lval* builtin_last(struct lenv* env, lval* args);
+lval* builtin_take(struct lenv* env, lval* args);
+lval* builtin_drop(struct lenv* env, lval* args);
+lval* builtin_split(struct lenv* env, lval* args);
+lval* builtin_elem(struct lenv* env, lval* args);
+lval* builtin_map(struct lenv* env, lval* args);
+lval* builtin_filter(struct lenv* env, lval* args);
+lval* builtin_foldl(struct lenv* env, lval* args);
+lval* builtin_sum(struct lenv* env, lval* args);
+lval* builtin_product(struct lenv* env, lval* args);
+lval* builtin_hash_map(struct lenv* env, lval* args);
+lval* builtin_get(struct lenv* env, lval* args);
+lval* builtin_assoc(struct lenv* env, lval* args);
+lval* builtin_dissoc(struct lenv* env, lval* args);
+lval* builtin_keys(struct lenv* env, lval* args);
+lval* builtin_count(struct lenv* env, lval* args);
 lval* builtin_lambda(struct lenv* env, lval* args);
+lval* builtin_memo(struct lenv* env, lval* args);
 lval* builtin_put(struct lenv* env, lval* args);
 lval* builtin_var(struct lenv* env, lval* args, char* func);
 lval* builtin_rok(struct lenv* env, lval* args);
@@ -0,0 +1,137 @@
+#include "lenv.h"
+#include "lval.h"
+#include "builtin.h"
+#include "lalloc.h"
+
+#if defined(ROK_MALLOC) && defined(ROK_GC)
+#error "ROK_GC sweeps the slabs and cannot be combined with ROK_MALLOC"
+#endif
+
+#ifdef ROK_MALLOC
+
+lval* lval_alloc(void) { return malloc(sizeof(lval)); }
+void lval_free(lval* val) { free(val); }
+lenv* lenv_alloc(void) { return malloc(sizeof(lenv)); }
+void lenv_free(lenv* env) { free(env); }
+
+#else
+
+/* Free lists are per thread so they need no locking */
+#if defined(__GNUC__)
+#define LALLOC_LOCAL __thread
+#else
+#define LALLOC_LOCAL
+#endif
+
+/*
+** A free struct holds the link to the next free one. Its first word
+** is overwritten with a marker no live lval or lenv can have, so the
+** collector can tell free structs apart when walking the slabs.
+*/
+typedef struct lfree lfree;
+struct lfree { void* header; lfree* next; };
+
+#define LALLOC_FREE ((void*)UINTPTR_MAX)
+
+static LALLOC_LOCAL lfree* lval_free_list = NULL;
+static LALLOC_LOCAL lfree* lenv_free_list = NULL;
+
+#ifdef ROK_GC
+/* Every slab handed out, so the collector can walk them */
+static char** lval_slabs = NULL;
+static int lval_slab_count = 0;
+static char** lenv_slabs = NULL;
+static int lenv_slab_count = 0;
+
+long lalloc_live = 0;
+
+static void lalloc_keep(char*** slabs, int* count, char* slab) {
+  (*count)++;
+  *slabs = realloc(*slabs, sizeof(char*) * *count);
+  (*slabs)[*count-1] = slab;
+}
+#endif
+
+/* Carve a new slab into a list of free structs of the given size */
+static lfree* lalloc_slab(size_t size) {
+  char* slab = malloc(size * LALLOC_SLAB);
+  for (int i = 0; i < LALLOC_SLAB; i++) {
+    lfree* x = (lfree*)(slab + size * i);
+    x->header = LALLOC_FREE;
+    x->next = (i < LALLOC_SLAB-1) ? (lfree*)(slab + size * (i+1)) : NULL;
+  }
+  return (lfree*)slab;
+}
+
+lval* lval_alloc(void) {
+  if (!lval_free_list) {
+    lval_free_list = lalloc_slab(sizeof(lval));
+#ifdef ROK_GC
+    lalloc_keep(&lval_slabs, &lval_slab_count, (char*)lval_free_list);
+#endif
+  }
+  lfree* x = lval_free_list;
+  lval_free_list = x->next;
+#ifdef ROK_GC
+  lalloc_live++;
+#endif
+  return (lval*)x;
+}
+
+void lval_free(lval* val) {
+  lfree* x = (lfree*)val;
+  x->header = LALLOC_FREE;
+  x->next = lval_free_list;
+  lval_free_list = x;
+#ifdef ROK_GC
+  lalloc_live--;
+#endif
+}
+
+lenv* lenv_alloc(void) {
+  if (!lenv_free_list) {
+    lenv_free_list = lalloc_slab(sizeof(lenv));
+#ifdef ROK_GC
+    lalloc_keep(&lenv_slabs, &lenv_slab_count, (char*)lenv_free_list);
+#endif
+  }
+  lfree* x = lenv_free_list;
+  lenv_free_list = x->next;
+#ifdef ROK_GC
+  lalloc_live++;
+#endif
+  return (lenv*)x;
+}
+
+void lenv_free(lenv* env) {
+  lfree* x = (lfree*)env;
+  x->header = LALLOC_FREE;
+  x->next = lenv_free_list;
+  lenv_free_list = x;
+#ifdef ROK_GC
+  lalloc_live--;
+#endif
+}
+
+#ifdef ROK_GC
+/* Visit every struct in use, visit may free the struct it is given */
+void lval_each(void (*visit)(lval*)) {
+  for (int i = 0; i < lval_slab_count; i++) {
+    for (int j = 0; j < LALLOC_SLAB; j++) {
+      lfree* x = (lfree*)(lval_slabs[i] + sizeof(lval) * j);
+      if (x->header != LALLOC_FREE) { visit((lval*)x); }
+    }
+  }
+}
+
+void lenv_each(void (*visit)(lenv*)) {
+  for (int i = 0; i < lenv_slab_count; i++) {
+    for (int j = 0; j < LALLOC_SLAB; j++) {
+      lfree* x = (lfree*)(lenv_slabs[i] + sizeof(lenv) * j);
+      if (x->header != LALLOC_FREE) { visit((lenv*)x); }
+    }
+  }
+}
+#endif
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef lalloc_h
+#define lalloc_h
+#include "builtin.h"
+#include "lenv.h"
+#include "lval.h"
+
+/* Number of structs carved out of each slab */
+#define LALLOC_SLAB 1024
+
+/*
+** lval and lenv structs come from slabs and are recycled through a
+** free list per struct type. Build with -DROK_MALLOC to use plain
+** malloc and free instead.
+*/
+lval* lval_alloc(void);
+void lval_free(lval* val);
+lenv* lenv_alloc(void);
+void lenv_free(lenv* env);
+
+#ifdef ROK_GC
+/* Structs currently allocated, and walking over them for the collector */
+extern long lalloc_live;
+void lval_each(void (*visit)(lval*));
+void lenv_each(void (*visit)(lenv*));
+#endif
+
+#endif
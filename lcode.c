@@ -0,0 +1,447 @@
+#include "lenv.h"
+#include "lval.h"
+#include "builtin.h"
+#include "lcode.h"
+
+/** Compiler **/
+
+/* Interned name of if, looked up when the first lambda is compiled */
+static char* lcode_if = NULL;
+
+static void lcode_emit(lcode* code, int op) {
+  /* Grow by doubling so emitting stays amortized O(1) */
+  if (code->count == code->capacity) {
+    code->capacity = code->capacity ? code->capacity * 2 : 16;
+    code->ops = realloc(code->ops, sizeof(int) * code->capacity);
+  }
+  code->ops[code->count++] = op;
+}
+
+/* Store a copy of a literal and return its index */
+static int lcode_const(lcode* code, lval* val) {
+  if (code->const_count == code->const_capacity) {
+    code->const_capacity = code->const_capacity ? code->const_capacity * 2 : 4;
+    code->consts = realloc(code->consts, sizeof(lval*) * code->const_capacity);
+  }
+  code->consts[code->const_count] = lval_copy(val);
+  return code->const_count++;
+}
+
+/* Track how deep the value stack grows */
+static void lcode_push(lcode* code, int* depth, int n) {
+  *depth += n;
+  if (*depth > code->max_stack) { code->max_stack = *depth; }
+}
+
+/* Matches (if cond {then} {else}) where both branches are literals */
+static int lcode_is_if(lval* expr) {
+  return expr->count == 4
+    && lval_type(expr->cell[0]) == LVAL_SYM
+    && expr->cell[0]->sym == lcode_if
+    && lval_type(expr->cell[2]) == LVAL_QEXPR
+    && lval_type(expr->cell[3]) == LVAL_QEXPR;
+}
+
+/* Frame slot a formal is bound to, or -1 if the symbol is not a formal */
+static int lcode_local(lcode* code, lval* sym) {
+  for (int i = 0; i < code->local_count; i++) {
+    if (code->locals[i] == sym->sym) { return i; }
+  }
+  return -1;
+}
+
+/* Work out the frame slot of each formal the same way lval_call binds them */
+static void lcode_bind_locals(lcode* code, lval* formals) {
+  for (int i = 0; i < formals->count; i++) {
+    lval* sym = formals->cell[i];
+    if (sym->sym == lenv_amp || lcode_local(code, sym) != -1) { continue; }
+    code->local_count++;
+    code->locals = realloc(code->locals, sizeof(char*) * code->local_count);
+    code->locals[code->local_count-1] = sym->sym;
+  }
+}
+
+static void lcode_compile_expr(lcode* code, lval* expr, int* depth);
+static void lcode_compile_sexpr(lcode* code, lval* expr, int* depth, int tail);
+
+static void lcode_compile_if(lcode* code, lval* expr, int* depth, int tail) {
+  /* Push 'if' itself and the condition */
+  lcode_compile_expr(code, expr->cell[0], depth);
+  lcode_compile_expr(code, expr->cell[1], depth);
+
+  /* Branches are kept as constants in case 'if' is not the builtin */
+  lcode_emit(code, OP_IF);
+  lcode_emit(code, lcode_const(code, expr->cell[2]));
+  lcode_emit(code, lcode_const(code, expr->cell[3]));
+  int else_at = code->count; lcode_emit(code, 0);
+  int end_at = code->count; lcode_emit(code, 0);
+  lcode_push(code, depth, 2);
+  *depth -= 4;
+  int base = *depth;
+
+  /* Then branch falls through and jumps over the else branch */
+  lcode_compile_sexpr(code, expr->cell[2], depth, tail);
+  lcode_emit(code, OP_JUMP);
+  int jump_at = code->count; lcode_emit(code, 0);
+
+  *depth = base;
+  code->ops[else_at] = code->count;
+  lcode_compile_sexpr(code, expr->cell[3], depth, tail);
+
+  code->ops[end_at] = code->count;
+  code->ops[jump_at] = code->count;
+}
+
+/* Compile each cell followed by a call, a tail call if nothing follows it */
+static void lcode_compile_sexpr(lcode* code, lval* expr, int* depth, int tail) {
+  if (lcode_is_if(expr)) {
+    lcode_compile_if(code, expr, depth, tail);
+    return;
+  }
+
+  for (int i = 0; i < expr->count; i++) {
+    lcode_compile_expr(code, expr->cell[i], depth);
+  }
+
+  lcode_emit(code, tail ? OP_TAIL : OP_CALL);
+  lcode_emit(code, expr->count);
+  *depth -= expr->count;
+  lcode_push(code, depth, 1);
+}
+
+static void lcode_compile_expr(lcode* code, lval* expr, int* depth) {
+  switch (lval_type(expr)) {
+    case LVAL_SYM: {
+      /* Formals are loaded straight from their slot in the call frame */
+      int slot = lcode_local(code, expr);
+      if (slot != -1) {
+        lcode_emit(code, OP_LOCAL);
+        lcode_emit(code, slot);
+      } else {
+        lcode_emit(code, OP_SYM);
+        lcode_emit(code, lcode_const(code, expr));
+      }
+      lcode_push(code, depth, 1);
+    }
+    break;
+    case LVAL_SEXPR:
+      lcode_compile_sexpr(code, expr, depth, 0);
+    break;
+    /* Everything else evaluates to itself */
+    default:
+      lcode_emit(code, OP_CONST);
+      lcode_emit(code, lcode_const(code, expr));
+      lcode_push(code, depth, 1);
+    break;
+  }
+}
+
+/* Compile a lambda body, evaluated as if it were an S-Expression */
+lcode* lcode_compile(lval* formals, lval* body) {
+  if (!lcode_if) { lcode_if = lenv_intern("if", lenv_hash("if")); }
+
+  lcode* code = malloc(sizeof(lcode));
+  code->refs = 1;
+  code->count = 0;
+  code->capacity = 0;
+  code->ops = NULL;
+  code->const_count = 0;
+  code->const_capacity = 0;
+  code->consts = NULL;
+  code->local_count = 0;
+  code->locals = NULL;
+  code->max_stack = 0;
+
+  /*
+  ** Frames take the caller's environment as parent, so only the
+  ** function's own formals have a fixed place. Every other symbol
+  ** is still looked up by name.
+  */
+  lcode_bind_locals(code, formals);
+
+  int depth = 0;
+  lcode_compile_sexpr(code, body, &depth, 1);
+  lcode_emit(code, OP_RETURN);
+  return code;
+}
+
+lcode* lcode_retain(lcode* code) {
+  code->refs++;
+  return code;
+}
+
+void lcode_del(lcode* code) {
+  if (--code->refs > 0) { return; }
+  for (int i = 0; i < code->const_count; i++) {
+    lval_del(code->consts[i]);
+  }
+  free(code->consts);
+  free(code->locals);
+  free(code->ops);
+  free(code);
+}
+
+/** Virtual machine **/
+
+/* Same as lval_eval_sexpr once every cell has been evaluated */
+lval* lcode_apply(lenv* env, lval** vals, int count) {
+  /* Error checking */
+  for (int i = 0; i < count; i++) {
+    if (lval_type(vals[i]) == LVAL_ERR) {
+      for (int j = 0; j < count; j++) {
+        if (j != i) { lval_del(vals[j]); }
+      }
+      return vals[i];
+    }
+  }
+
+  /* Empty Expression */
+  if (count == 0) { return lval_sexpr(); }
+
+  /* Single Expression */
+  if (count == 1) { return lval_eval(env, vals[0]); }
+
+  /* Ensure First Element is a function */
+  lval* fun = vals[0];
+  if (lval_type(fun) != LVAL_FUN) {
+    lval* err = lval_err(
+      "S-Expression starts with incorrect type. "
+      "Got %s, Expected %s. ",
+      ltype_name(lval_type(fun)), ltype_name(LVAL_FUN));
+    for (int i = 0; i < count; i++) { lval_del(vals[i]); }
+    return err;
+  }
+
+  /* Gather the remaining values into an argument list */
+  lval* args = lval_sexpr();
+  lval_reserve(args, count-1);
+  memcpy(args->cell, &vals[1], sizeof(lval*) * (count-1));
+  args->count = count-1;
+
+  lval* result = lval_call(env, fun, args);
+  lval_del(fun);
+  return result;
+}
+
+/* Check if a call on these values can be made by reusing the running VM */
+static int lcode_can_tail(lval** vals, int count) {
+  if (count < 2 || lval_type(vals[0]) != LVAL_FUN) { return 0; }
+  if (vals[0]->builtin || vals[0]->memo || !vals[0]->lambda->code) { return 0; }
+  for (int i = 0; i < count; i++) {
+    if (lval_type(vals[i]) == LVAL_ERR) { return 0; }
+  }
+  return 1;
+}
+
+/* Check if a frame made for calling fun would bind sym */
+static int lcode_binds(lval* fun, char* sym) {
+  for (int i = 0; i < fun->lambda->formals->count; i++) {
+    if (fun->lambda->formals->cell[i]->sym == sym) { return 1; }
+  }
+  lenv* env = fun->lambda->env;
+  for (int i = 0; i < env->count; i++) {
+    if (env->syms[i] == sym) { return 1; }
+  }
+  return 0;
+}
+
+/*
+** A join whose result only has plain values after it before a tail
+** call that replaces this frame is the last use of the formals passed
+** to it. Drop the frame's reference to those so join can append to a
+** list it holds alone rather than copying it, which would make an
+** accumulating loop quadratic. Nothing can read the frame afterwards
+** unless the tail call leaves it on the chain, so that is checked
+** against the callee already on the stack. Only formals are released,
+** names bound later with = are left alone.
+*/
+static void lcode_release(lenv* frame, lcode* code, int ip, lval** stack, int sp) {
+  int* ops = code->ops;
+  int count = ops[ip+1];
+  lval* fun = stack[sp];
+  if (lval_type(fun) != LVAL_FUN || fun->builtin != builtin_join) { return; }
+
+  /* Skip the loads of the remaining arguments to find the tail call */
+  int at = ip + 2;
+  int loads = 0;
+  while (ops[at] == OP_CONST || ops[at] == OP_SYM || ops[at] == OP_LOCAL) {
+    at += 2;
+    loads++;
+  }
+  if (ops[at] != OP_TAIL) { return; }
+
+  int callee_at = sp + 1 + loads - ops[at+1];
+  if (callee_at < 0 || callee_at >= sp) { return; }
+  lval* callee = stack[callee_at];
+  if (lval_type(callee) != LVAL_FUN || callee->builtin || callee->memo
+    || !callee->lambda->code) { return; }
+  for (int i = 0; i < frame->count; i++) {
+    if (!lcode_binds(callee, frame->syms[i])) { return; }
+  }
+
+  for (int i = 1; i < count; i++) {
+    lval* arg = stack[sp+i];
+    if (lval_immediate(arg) || arg->refs != 2) { continue; }
+    for (int s = 0; s < code->local_count && s < frame->count; s++) {
+      if (frame->vals[s] != arg || frame->syms[s] != code->locals[s]) { continue; }
+
+      /* Still needed if it is loaded again before the tail call */
+      int loaded = 0;
+      for (int j = ip + 2; j < at; j += 2) {
+        if (ops[j] == OP_LOCAL && ops[j+1] == s) { loaded = 1; }
+        if (ops[j] == OP_SYM && code->consts[ops[j+1]]->sym == frame->syms[s]) {
+          loaded = 1;
+        }
+      }
+      if (!loaded) {
+        frame->vals[s] = lval_bool(0);
+        lval_del(arg);
+      }
+      break;
+    }
+  }
+}
+
+/* Run a lambda in a frame made by lval_bind, the frame is deleted after */
+lval* lcode_eval(lenv* frame, lval* fun) {
+  /* Frames above base belong to this run */
+  lenv* base = frame->parent;
+
+  /* Function tail called into, released once we move on from it */
+  lval* callee = NULL;
+
+  lcode* code = fun->lambda->code;
+  int* ops = code->ops;
+  int sp = 0;
+  int ip = 0;
+
+  /* Use a small stack on the C stack unless the code needs more */
+  lval* small[LCODE_STACK];
+  lval** stack = small;
+  int size = LCODE_STACK;
+  if (code->max_stack > size) {
+    size = code->max_stack;
+    stack = malloc(sizeof(lval*) * size);
+  }
+
+  while (1) {
+    switch (ops[ip]) {
+      case OP_CONST:
+        stack[sp++] = lval_copy(code->consts[ops[ip+1]]);
+        ip += 2;
+      break;
+
+      case OP_SYM:
+        stack[sp++] = lenv_get(frame, code->consts[ops[ip+1]]);
+        ip += 2;
+      break;
+
+      case OP_LOCAL:
+        stack[sp++] = lval_copy(frame->vals[ops[ip+1]]);
+        ip += 2;
+      break;
+
+      case OP_CALL:
+        sp -= ops[ip+1];
+        lcode_release(frame, code, ip, stack, sp);
+        stack[sp] = lcode_apply(frame, &stack[sp], ops[ip+1]);
+        sp++;
+        ip += 2;
+      break;
+
+      case OP_TAIL: {
+        int count = ops[ip+1];
+        sp -= count;
+
+        if (!lcode_can_tail(&stack[sp], count)) {
+          stack[sp] = lcode_apply(frame, &stack[sp], count);
+          sp++;
+          ip += 2;
+          break;
+        }
+
+        /* Bind the arguments, the caller's frame is the new parent */
+        lval* next = stack[sp];
+        lval* args = lval_sexpr();
+        lval_reserve(args, count-1);
+        memcpy(args->cell, &stack[sp+1], sizeof(lval*) * (count-1));
+        args->count = count-1;
+
+        lval* result;
+        lenv* next_frame = lval_bind(frame, next, args, &result);
+        if (!next_frame) {
+          lval_del(next);
+          stack[sp++] = result;
+          ip += 2;
+          break;
+        }
+
+        /*
+        ** Lookups only reach our frame for names the new frame lacks.
+        ** If it binds all of them ours can be dropped right away,
+        ** otherwise it stays on the chain until we return.
+        */
+        if (lenv_covers(next_frame, frame)) {
+          next_frame->parent = frame->parent;
+          lenv_del(frame);
+        }
+        frame = next_frame;
+
+        /* Continue with the callee's code from the start */
+        if (callee) { lval_del(callee); }
+        callee = next;
+        code = callee->lambda->code;
+        ops = code->ops;
+        ip = 0;
+        if (code->max_stack > size) {
+          size = code->max_stack;
+          stack = (stack == small)
+            ? malloc(sizeof(lval*) * size)
+            : realloc(stack, sizeof(lval*) * size);
+        }
+      }
+      break;
+
+      case OP_IF: {
+        lval* fun = stack[sp-2];
+        lval* cond = stack[sp-1];
+
+        /* Builtin 'if' on a boolean runs the compiled branch directly */
+        if (lval_type(fun) == LVAL_FUN && fun->builtin == builtin_if
+          && lval_type(cond) == LVAL_BOOL) {
+          int truth = lval_is_true(cond);
+          lval_del(fun);
+          sp -= 2;
+          ip = truth ? ip + 5 : ops[ip+3];
+        } else {
+          /* Otherwise call it like any other expression */
+          stack[sp++] = lval_copy(code->consts[ops[ip+1]]);
+          stack[sp++] = lval_copy(code->consts[ops[ip+2]]);
+          sp -= 4;
+          stack[sp] = lcode_apply(frame, &stack[sp], 4);
+          sp++;
+          ip = ops[ip+4];
+        }
+      }
+      break;
+
+      case OP_JUMP:
+        ip = ops[ip+1];
+      break;
+
+      case OP_RETURN: {
+        lval* result = stack[sp-1];
+
+        /* Clean up every frame this run created */
+        while (frame != base) {
+          lenv* parent = frame->parent;
+          lenv_del(frame);
+          frame = parent;
+        }
+        if (callee) { lval_del(callee); }
+        if (stack != small) { free(stack); }
+        return result;
+      }
+    }
+  }
+}
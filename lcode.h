@@ -0,0 +1,45 @@
+#ifndef lcode_h
+#define lcode_h
+#include "builtin.h"
+#include "lenv.h"
+#include "lval.h"
+
+/* Bytecode compiled from a lambda body */
+typedef struct lcode lcode;
+
+struct lcode {
+  int refs;
+
+  /* Instructions and their operands */
+  int count;
+  int capacity;
+  int* ops;
+
+  /* Literal values and symbols referenced by the instructions */
+  int const_count;
+  int const_capacity;
+  struct lval** consts;
+
+  /* Formal names in the order they are bound into the call frame */
+  int local_count;
+  char** locals;
+
+  /* Deepest the value stack can get while running */
+  int max_stack;
+};
+
+/* Declare Enumerations for opcodes */
+enum lcode_ops {
+  OP_CONST, OP_SYM, OP_LOCAL, OP_CALL, OP_TAIL, OP_IF, OP_JUMP, OP_RETURN
+};
+
+/* Value stack slots kept on the C stack, deeper code allocates */
+#define LCODE_STACK 16
+
+lcode* lcode_compile(struct lval* formals, struct lval* body);
+lcode* lcode_retain(lcode* code);
+void lcode_del(lcode* code);
+struct lval* lcode_eval(lenv* frame, struct lval* fun);
+struct lval* lcode_apply(lenv* env, struct lval** vals, int count);
+
+#endif
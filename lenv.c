@@ -1,74 +1,226 @@
+#include <stddef.h>
 #include "lenv.h"
 #include "lval.h"
 #include "builtin.h"
+#include "lalloc.h"
+
+/* Environments with more entries than this get a hash index */
+#define LENV_FLAT_MAX 8
 
 /** Lenv functions **/
 lenv* lenv_new(void) {
-  lenv* env = malloc(sizeof(lenv));
+  lenv* env = lenv_alloc();
   env->parent = NULL;
   env->count = 0;
   env->syms = NULL;
+  env->hashes = NULL;
   env->vals = NULL;
+  env->capacity = 0;
+  env->table = NULL;
+  env->marked = 0;
   return env;
 }
 
 void lenv_del(lenv* env) {
   for(int i = 0; i < env->count; i++) {
-    free(env->syms[i]);
     lval_del(env->vals[i]);
   }
   free(env->syms);
+  free(env->hashes);
   free(env->vals);
-  free(env);
+  free(env->table);
+  lenv_free(env);
 }
 
-lval* lenv_get(lenv* env, lval* var) {
-  /* Iterate over all items in the environment */
-  for (int i = 0; i < env->count; i++) {
-    if(strcmp(env->syms[i], var->sym) == 0) {
-      return lval_copy(env->vals[i]);
+/* FNV-1a hash of a symbol name */
+unsigned long lenv_hash(char* sym) {
+  unsigned long hash = 2166136261UL;
+  for (unsigned char* c = (unsigned char*)sym; *c; c++) {
+    hash = (hash ^ *c) * 16777619UL;
+  }
+  return hash;
+}
+
+/** Symbol table **/
+
+/* A symbol name stored once, so names can be compared by pointer */
+typedef struct lname {
+  unsigned long hash;
+
+  /* Set once the name is bound in a call frame */
+  int local;
+
+  char text[];
+} lname;
+
+static lname** lenv_names = NULL;
+static int lenv_name_count = 0;
+static int lenv_name_capacity = 0;
+
+/* Interned name of the '&' formal */
+char* lenv_amp = NULL;
+
+/* Environment the builtins were added to, the root of every lookup */
+static lenv* lenv_global = NULL;
+
+/* The stored name holding an interned symbol */
+static lname* lenv_name(char* sym) {
+  return (lname*)(sym - offsetof(lname, text));
+}
+
+static void lenv_names_grow(void) {
+  lname** names = lenv_names;
+  int capacity = lenv_name_capacity;
+
+  lenv_name_capacity = capacity ? capacity * 2 : 256;
+  lenv_names = calloc(lenv_name_capacity, sizeof(lname*));
+
+  /* Move the old names over */
+  unsigned long mask = lenv_name_capacity - 1;
+  for (int i = 0; i < capacity; i++) {
+    if (!names[i]) { continue; }
+    unsigned long slot = names[i]->hash & mask;
+    while (lenv_names[slot]) { slot = (slot + 1) & mask; }
+    lenv_names[slot] = names[i];
+  }
+  free(names);
+}
+
+/* Return the one stored copy of a symbol name, adding it if new */
+char* lenv_intern(char* sym, unsigned long hash) {
+  if (!lenv_names) {
+    lenv_names_grow();
+    lenv_amp = lenv_intern("&", lenv_hash("&"));
+  }
+
+  unsigned long mask = lenv_name_capacity - 1;
+  unsigned long slot = hash & mask;
+  while (lenv_names[slot]) {
+    if (lenv_names[slot]->hash == hash && strcmp(lenv_names[slot]->text, sym) == 0) {
+      return lenv_names[slot]->text;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  lname* name = malloc(sizeof(lname) + strlen(sym) + 1);
+  name->hash = hash;
+  name->local = 0;
+  strcpy(name->text, sym);
+  lenv_names[slot] = name;
+
+  /* Keep the table at most half full */
+  if (++lenv_name_count * 2 > lenv_name_capacity) { lenv_names_grow(); }
+  return name->text;
+}
+
+/* Place entry i in the index using linear probing */
+static void lenv_index(lenv* env, int i) {
+  unsigned long mask = env->capacity - 1;
+  unsigned long slot = env->hashes[i] & mask;
+  while (env->table[slot] != -1) { slot = (slot + 1) & mask; }
+  env->table[slot] = i;
+}
+
+/* Rebuild the index, keeping it at most half full */
+static void lenv_rehash(lenv* env) {
+  env->capacity = env->capacity ? env->capacity * 2 : 32;
+  env->table = realloc(env->table, sizeof(int) * env->capacity);
+  for (int i = 0; i < env->capacity; i++) { env->table[i] = -1; }
+  for (int i = 0; i < env->count; i++) { lenv_index(env, i); }
+}
+
+/* Return the entry index for an interned name in this environment, or -1 */
+static int lenv_find(lenv* env, char* sym, unsigned long hash) {
+  if (env->table) {
+    unsigned long mask = env->capacity - 1;
+    unsigned long slot = hash & mask;
+    while (env->table[slot] != -1) {
+      int i = env->table[slot];
+      if (env->syms[i] == sym) { return i; }
+      slot = (slot + 1) & mask;
     }
+    return -1;
+  }
+
+  /* Small environments are scanned, names are interned so compare pointers */
+  for (int i = 0; i < env->count; i++) {
+    if (env->syms[i] == sym) { return i; }
+  }
+  return -1;
+}
+
+/* Check if every name bound in other is also bound in env */
+int lenv_covers(lenv* env, lenv* other) {
+  for (int i = 0; i < other->count; i++) {
+    if (lenv_find(env, other->syms[i], other->hashes[i]) == -1) { return 0; }
   }
+  return 1;
+}
+
+lval* lenv_get(lenv* env, lval* var) {
+  /* A name never bound in a call frame can only be global */
+  if (!lenv_name(var->sym)->local && lenv_global) { env = lenv_global; }
 
-  if (env->parent) {
-    return lenv_get(env->parent, var);
-  } else {
-    return lval_err("unbound symbol '%s'!", var->sym);
+  /* Walk up the environments until the symbol is found */
+  for (lenv* e = env; e; e = e->parent) {
+    int i = lenv_find(e, var->sym, var->hash);
+    if (i != -1) { return lval_copy(e->vals[i]); }
   }
+  return lval_err("unbound symbol '%s'!", var->sym);
 }
 
 void lenv_put(lenv* env, lval* var, lval* val) {
-  /* Iterate */
-  for (int i = 0; i < env->count; i++) {
-    if(strcmp(env->syms[i], var->sym) == 0) {
-      lval_del(env->vals[i]);
-      env->vals[i] = lval_copy(val);
-      return;
-    }
+  /* Lookups of this name can no longer skip the call frames */
+  if (env->parent) { lenv_name(var->sym)->local = 1; }
+
+  /* Replace existing entry */
+  int i = lenv_find(env, var->sym, var->hash);
+  if (i != -1) {
+    lval_del(env->vals[i]);
+    env->vals[i] = lval_copy(val);
+    return;
   }
 
   /* If no existing entry found, allocate space for new entry */
   env->count++;
   env->vals = realloc(env->vals, sizeof(lval*) * env->count);
   env->syms = realloc(env->syms, sizeof(char*) * env->count);
+  env->hashes = realloc(env->hashes, sizeof(unsigned long) * env->count);
 
-  /* Copy contents of lval and symbol string to new location */
+  /* Copy contents of lval and share the interned symbol name */
   env->vals[env->count-1] = lval_copy(val);
-  env->syms[env->count-1] = malloc(strlen(var->sym)+1);
-  strcpy(env->syms[env->count-1], var->sym);
+  env->syms[env->count-1] = var->sym;
+  env->hashes[env->count-1] = var->hash;
+
+  /* Index the new entry, growing the table when it gets half full */
+  if (env->count > LENV_FLAT_MAX) {
+    if (env->count * 2 > env->capacity) {
+      lenv_rehash(env);
+    } else {
+      lenv_index(env, env->count-1);
+    }
+  }
 }
 
 lenv* lenv_copy(lenv* env) {
-  lenv* copy = malloc(sizeof(lenv));
+  lenv* copy = lenv_alloc();
   copy->parent = env->parent;
   copy->count = env->count;
   copy->syms = malloc(sizeof(char*) * env->count);
+  copy->hashes = malloc(sizeof(unsigned long) * env->count);
   copy->vals = malloc(sizeof(lval*) * env->count);
   for (int i = 0; i < env->count; i++) {
-    copy->syms[i] = malloc(strlen(env->syms[i]) + 1);
-    strcpy(copy->syms[i], env->syms[i]);
+    copy->syms[i] = env->syms[i];
+    copy->hashes[i] = env->hashes[i];
     copy->vals[i] = lval_copy(env->vals[i]);
   }
+  copy->capacity = env->capacity;
+  copy->table = NULL;
+  if (env->table) {
+    copy->table = malloc(sizeof(int) * env->capacity);
+    memcpy(copy->table, env->table, sizeof(int) * env->capacity);
+  }
+  copy->marked = 0;
   return copy;
 }
 
@@ -87,6 +239,8 @@ void lenv_add_builtin(lenv* env, char* name, lbuiltin func) {
 }
 
 void lenv_add_builtins(lenv* env) {
+  lenv_global = env;
+
   /* List functions */
   lenv_add_builtin(env, "list", builtin_list);
   lenv_add_builtin(env, "head", builtin_head);
@@ -94,6 +248,31 @@ void lenv_add_builtins(lenv* env) {
   lenv_add_builtin(env, "eval", builtin_eval);
   lenv_add_builtin(env, "len", builtin_len);
   lenv_add_builtin(env, "join", builtin_join);
+  lenv_add_builtin(env, "nth", builtin_nth);
+  lenv_add_builtin(env, "last", builtin_last);
+  lenv_add_builtin(env, "take", builtin_take);
+  lenv_add_builtin(env, "drop", builtin_drop);
+  lenv_add_builtin(env, "split", builtin_split);
+  lenv_add_builtin(env, "elem", builtin_elem);
+  lenv_add_builtin(env, "map", builtin_map);
+  lenv_add_builtin(env, "filter", builtin_filter);
+  lenv_add_builtin(env, "foldl", builtin_foldl);
+  lenv_add_builtin(env, "sum", builtin_sum);
+  lenv_add_builtin(env, "product", builtin_product);
+
+  /* Map functions */
+  lenv_add_builtin(env, "hash-map", builtin_hash_map);
+  lenv_add_builtin(env, "get", builtin_get);
+  lenv_add_builtin(env, "assoc", builtin_assoc);
+  lenv_add_builtin(env, "dissoc", builtin_dissoc);
+  lenv_add_builtin(env, "keys", builtin_keys);
+  lenv_add_builtin(env, "count", builtin_count);
+
+  /* A call with no arguments evaluates to the function, so name the empty map */
+  lval* var = lval_sym("empty-map");
+  lval* val = lval_map();
+  lenv_put(env, var, val);
+  lval_del(var); lval_del(val);
 
   /* Math functions */
   lenv_add_builtin(env, "+", builtin_add);
@@ -117,6 +296,7 @@ void lenv_add_builtins(lenv* env) {
 
   /* Lambda functions */
   lenv_add_builtin(env, "\\", builtin_lambda);
+  lenv_add_builtin(env, "memo", builtin_memo);
 
   /* File system functions */
   lenv_add_builtin(env, "load", builtin_load);
@@ -11,14 +11,27 @@ struct lenv {
   lenv* parent;
   int count;
   char** syms;
+  unsigned long* hashes;
   struct lval** vals;
+
+  /* Open addressing index of entries, only built for large environments */
+  int capacity;
+  int* table;
+
+  /* Set while the collector marks what is reachable */
+  int marked;
 };
 
+extern char* lenv_amp;
+
 lenv* lenv_new(void);
+unsigned long lenv_hash(char* sym);
+char* lenv_intern(char* sym, unsigned long hash);
 void lenv_del(lenv* env);
 struct lval* lenv_get(lenv* env, struct lval* var);
 void lenv_put(lenv* env, struct lval* var, struct lval* val);
 lenv* lenv_copy(lenv* env);
+int lenv_covers(lenv* env, lenv* other);
 void lenv_def(lenv* env, struct lval* var, struct lval* val);
 void lenv_add_builtin(lenv* env, char* name, lbuiltin func);
 void lenv_add_builtins(lenv* env);
@@ -0,0 +1,144 @@
+#include "lenv.h"
+#include "lval.h"
+#include "builtin.h"
+#include "lalloc.h"
+#include "lcode.h"
+#include "lmap.h"
+#include "lmemo.h"
+#include "lgc.h"
+
+#ifdef ROK_GC
+
+/* Evaluations in progress, collecting is only safe at zero */
+int lgc_depth = 0;
+
+/* Set during the sweep, lval_del then leaves values to the sweep */
+int lgc_sweeping = 0;
+
+/* Values held by C code across a safe point */
+static lval** lgc_roots = NULL;
+static int lgc_root_count = 0;
+static int lgc_root_capacity = 0;
+
+/* Collect again once this many structs are live */
+static long lgc_next = LGC_THRESHOLD;
+
+void lgc_push(lval* root) {
+  if (lgc_root_count == lgc_root_capacity) {
+    lgc_root_capacity = lgc_root_capacity ? lgc_root_capacity * 2 : 16;
+    lgc_roots = realloc(lgc_roots, sizeof(lval*) * lgc_root_capacity);
+  }
+  lgc_roots[lgc_root_count++] = root;
+}
+
+void lgc_pop(void) {
+  lgc_root_count--;
+}
+
+/** Mark **/
+static void lgc_mark_env(lenv* env);
+
+static void lgc_mark(lval* val) {
+  if (lval_immediate(val) || (val->type & LGC_MARK)) { return; }
+  val->type |= LGC_MARK;
+
+  switch (val->type & ~LGC_MARK) {
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (val->capacity == LVAL_SLICE) {
+        lgc_mark(val->owner);
+        break;
+      }
+      for (int i = 0; i < val->count; i++) { lgc_mark(val->cell[i]); }
+    break;
+    case LVAL_FUN:
+      if (val->memo) {
+        lmemo_each(val->memo, lgc_mark);
+      } else if (!val->builtin) {
+        lgc_mark_env(val->lambda->env);
+        lgc_mark(val->lambda->formals);
+        lgc_mark(val->lambda->body);
+        lcode* code = val->lambda->code;
+        if (code) {
+          for (int i = 0; i < code->const_count; i++) { lgc_mark(code->consts[i]); }
+        }
+      }
+    break;
+    case LVAL_MAP:
+      if (val->map) { lmap_each(val->map, lgc_mark); }
+    break;
+  }
+}
+
+static void lgc_mark_env(lenv* env) {
+  for (; env && !env->marked; env = env->parent) {
+    env->marked = 1;
+    for (int i = 0; i < env->count; i++) { lgc_mark(env->vals[i]); }
+  }
+}
+
+/** Sweep **/
+
+/* Free what an unreached lval owns, its children are swept on their own */
+static void lgc_sweep_lval(lval* val) {
+  if (val->type & LGC_MARK) {
+    val->type &= ~LGC_MARK;
+    return;
+  }
+
+  switch (val->type) {
+    case LVAL_ERR: free(val->err); break;
+    case LVAL_STR:
+      if (val->str != val->small) { free(val->str); }
+    break;
+    case LVAL_FUN:
+      if (val->memo) {
+        lmemo_del(val->memo);
+      } else if (!val->builtin) {
+        if (val->lambda->code) { lcode_del(val->lambda->code); }
+        free(val->lambda);
+      }
+    break;
+    case LVAL_MAP:
+      if (val->map) { lmap_del(val->map); }
+    break;
+    case LVAL_QEXPR:
+    case LVAL_SEXPR:
+      lval_free_cells(val);
+    break;
+  }
+  lval_free(val);
+}
+
+static void lgc_sweep_env(lenv* env) {
+  if (env->marked) {
+    env->marked = 0;
+    return;
+  }
+  free(env->syms);
+  free(env->hashes);
+  free(env->vals);
+  free(env->table);
+  lenv_free(env);
+}
+
+/* Free everything not reachable from env, its parents or the roots */
+void lgc_collect(lenv* env) {
+  lgc_mark_env(env);
+  for (int i = 0; i < lgc_root_count; i++) { lgc_mark(lgc_roots[i]); }
+
+  lgc_sweeping = 1;
+  lval_each(lgc_sweep_lval);
+  lenv_each(lgc_sweep_env);
+  lgc_sweeping = 0;
+
+  /* Let the heap double before running again */
+  lgc_next = lalloc_live * 2 > LGC_THRESHOLD ? lalloc_live * 2 : LGC_THRESHOLD;
+}
+
+/* Collect if enough has been allocated and nothing is being evaluated */
+void lgc_safe_point(lenv* env) {
+  if (lgc_depth == 0 && lalloc_live >= lgc_next) { lgc_collect(env); }
+}
+
+#endif
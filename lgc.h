@@ -0,0 +1,47 @@
+#ifndef lgc_h
+#define lgc_h
+#include "builtin.h"
+#include "lenv.h"
+#include "lval.h"
+
+/*
+** Tracing collector, built in with -DROK_GC. Reference counts still
+** free most values the moment they are dropped. The collector picks
+** up whatever they miss, references leaked by a builtin or values
+** kept alive by a cycle, by marking everything reachable from the
+** global environment and the registered roots and sweeping the rest
+** out of the slabs.
+**
+** Values held in C locals are invisible to it, so it only runs at
+** safe points where no evaluation is in progress.
+*/
+#ifdef ROK_GC
+
+/* Structs allocated before the first collection */
+#define LGC_THRESHOLD 65536
+
+/* Set in the type of an lval while the collector marks */
+#define LGC_MARK 0x100
+
+extern int lgc_depth;
+extern int lgc_sweeping;
+
+void lgc_push(lval* root);
+void lgc_pop(void);
+void lgc_collect(lenv* env);
+void lgc_safe_point(lenv* env);
+
+/* Track nested evaluation */
+#define LGC_ENTER() (lgc_depth++)
+#define LGC_LEAVE() (lgc_depth--)
+
+#else
+
+#define LGC_ENTER()
+#define LGC_LEAVE()
+#define lgc_push(root)
+#define lgc_pop()
+#define lgc_safe_point(env)
+
+#endif
+#endif
@@ -0,0 +1,285 @@
+#include "lenv.h"
+#include "lval.h"
+#include "builtin.h"
+#include "lmap.h"
+
+/* Once the hash is used up keys that still collide are kept in a list */
+#define LMAP_HASH_BITS ((int)sizeof(unsigned long) * 8)
+
+#if defined(__GNUC__)
+#define lmap_popcount(x) __builtin_popcount(x)
+#else
+static int lmap_popcount(unsigned int x) {
+  int n = 0;
+  for (; x; x &= x - 1) { n++; }
+  return n;
+}
+#endif
+
+/* Bit for the slot a hash falls into at this level */
+static unsigned int lmap_bit(unsigned long hash, int shift) {
+  return 1u << ((hash >> shift) & ((1u << LMAP_BITS) - 1));
+}
+
+static int lmap_same_key(lslot* slot, unsigned long hash, lval* key) {
+  return !slot->node && slot->hash == hash && lval_is_true(lval_eq(slot->key, key));
+}
+
+static lnode* lmap_node(unsigned int bitmap, int count) {
+  lnode* node = malloc(sizeof(lnode) + sizeof(lslot) * count);
+  node->refs = 1;
+  node->bitmap = bitmap;
+  node->count = count;
+  return node;
+}
+
+lnode* lmap_retain(lnode* node) {
+  node->refs++;
+  return node;
+}
+
+void lmap_del(lnode* node) {
+  if (--node->refs > 0) { return; }
+  for (int i = 0; i < node->count; i++) {
+    lslot* slot = &node->slots[i];
+    if (slot->node) {
+      lmap_del(slot->node);
+    } else {
+      lval_del(slot->key);
+      lval_del(slot->val);
+    }
+  }
+  free(node);
+}
+
+static void lmap_leaf(lslot* slot, unsigned long hash, lval* key, lval* val) {
+  slot->hash = hash;
+  slot->key = lval_copy(key);
+  slot->val = lval_copy(val);
+  slot->node = NULL;
+}
+
+/* Share a slot with a new node */
+static void lmap_share(lslot* to, lslot* from) {
+  *to = *from;
+  if (from->node) {
+    lmap_retain(from->node);
+  } else {
+    lval_copy(from->key);
+    lval_copy(from->val);
+  }
+}
+
+/* Copy of a node sharing all of its slots */
+static lnode* lmap_copy(lnode* node) {
+  lnode* x = lmap_node(node->bitmap, node->count);
+  for (int i = 0; i < node->count; i++) { lmap_share(&x->slots[i], &node->slots[i]); }
+  return x;
+}
+
+/* Copy of a node without slot i, or NULL if that was the last one */
+static lnode* lmap_without(lnode* node, int i, unsigned int bitmap) {
+  if (node->count == 1) { return NULL; }
+  lnode* x = lmap_node(bitmap, node->count-1);
+  for (int j = 0, k = 0; j < node->count; j++) {
+    if (j != i) { lmap_share(&x->slots[k++], &node->slots[j]); }
+  }
+  return x;
+}
+
+lval* lmap_get(lnode* node, unsigned long hash, lval* key) {
+  for (int shift = 0; node; shift += LMAP_BITS) {
+    if (shift >= LMAP_HASH_BITS) {
+      for (int i = 0; i < node->count; i++) {
+        if (lmap_same_key(&node->slots[i], hash, key)) { return node->slots[i].val; }
+      }
+      return NULL;
+    }
+
+    unsigned int bit = lmap_bit(hash, shift);
+    if (!(node->bitmap & bit)) { return NULL; }
+    lslot* slot = &node->slots[lmap_popcount(node->bitmap & (bit - 1))];
+    if (!slot->node) { return lmap_same_key(slot, hash, key) ? slot->val : NULL; }
+    node = slot->node;
+  }
+  return NULL;
+}
+
+/** Updates, each returns a new node and leaves the one given alone **/
+
+static lnode* lmap_assoc_list(lnode* node, unsigned long hash, lval* key, lval* val, int* added) {
+  int count = node ? node->count : 0;
+  for (int i = 0; i < count; i++) {
+    if (lmap_same_key(&node->slots[i], hash, key)) {
+      lnode* x = lmap_copy(node);
+      lval_del(x->slots[i].val);
+      x->slots[i].val = lval_copy(val);
+      return x;
+    }
+  }
+
+  lnode* x = lmap_node(0, count+1);
+  for (int i = 0; i < count; i++) { lmap_share(&x->slots[i], &node->slots[i]); }
+  lmap_leaf(&x->slots[count], hash, key, val);
+  *added = 1;
+  return x;
+}
+
+static lnode* lmap_assoc_at(lnode* node, unsigned long hash, lval* key, lval* val, int shift, int* added) {
+  if (shift >= LMAP_HASH_BITS) { return lmap_assoc_list(node, hash, key, val, added); }
+
+  unsigned int bit = lmap_bit(hash, shift);
+  if (!node) {
+    lnode* x = lmap_node(bit, 1);
+    lmap_leaf(&x->slots[0], hash, key, val);
+    *added = 1;
+    return x;
+  }
+
+  /* Free slot, insert the key in order */
+  int i = lmap_popcount(node->bitmap & (bit - 1));
+  if (!(node->bitmap & bit)) {
+    lnode* x = lmap_node(node->bitmap | bit, node->count+1);
+    for (int j = 0; j < i; j++) { lmap_share(&x->slots[j], &node->slots[j]); }
+    lmap_leaf(&x->slots[i], hash, key, val);
+    for (int j = i; j < node->count; j++) { lmap_share(&x->slots[j+1], &node->slots[j]); }
+    *added = 1;
+    return x;
+  }
+
+  lnode* x = lmap_copy(node);
+  lslot* slot = &x->slots[i];
+  if (slot->node) {
+    /* Update the child node */
+    lnode* child = lmap_assoc_at(slot->node, hash, key, val, shift + LMAP_BITS, added);
+    lmap_del(slot->node);
+    slot->node = child;
+  } else if (lmap_same_key(slot, hash, key)) {
+    /* Replace the value */
+    lval_del(slot->val);
+    slot->val = lval_copy(val);
+  } else {
+    /* Another key is here, push both down into a new child node */
+    int ignored = 0;
+    lnode* child = lmap_assoc_at(NULL, slot->hash, slot->key, slot->val, shift + LMAP_BITS, &ignored);
+    lnode* both = lmap_assoc_at(child, hash, key, val, shift + LMAP_BITS, added);
+    lmap_del(child);
+    lval_del(slot->key);
+    lval_del(slot->val);
+    slot->key = NULL;
+    slot->val = NULL;
+    slot->node = both;
+  }
+  return x;
+}
+
+lnode* lmap_assoc(lnode* node, unsigned long hash, lval* key, lval* val, int* added) {
+  return lmap_assoc_at(node, hash, key, val, 0, added);
+}
+
+static lnode* lmap_dissoc_at(lnode* node, unsigned long hash, lval* key, int shift, int* removed) {
+  if (shift >= LMAP_HASH_BITS) {
+    for (int i = 0; i < node->count; i++) {
+      if (lmap_same_key(&node->slots[i], hash, key)) {
+        *removed = 1;
+        return lmap_without(node, i, 0);
+      }
+    }
+    return lmap_retain(node);
+  }
+
+  unsigned int bit = lmap_bit(hash, shift);
+  if (!(node->bitmap & bit)) { return lmap_retain(node); }
+  int i = lmap_popcount(node->bitmap & (bit - 1));
+  lslot* slot = &node->slots[i];
+
+  if (!slot->node) {
+    if (!lmap_same_key(slot, hash, key)) { return lmap_retain(node); }
+    *removed = 1;
+    return lmap_without(node, i, node->bitmap & ~bit);
+  }
+
+  lnode* child = lmap_dissoc_at(slot->node, hash, key, shift + LMAP_BITS, removed);
+  if (!*removed) {
+    lmap_del(child);
+    return lmap_retain(node);
+  }
+  if (!child) { return lmap_without(node, i, node->bitmap & ~bit); }
+
+  lnode* x = lmap_copy(node);
+  lmap_del(x->slots[i].node);
+  if (child->count == 1 && !child->slots[0].node) {
+    /* A single key left in the child moves back up into this node */
+    lmap_share(&x->slots[i], &child->slots[0]);
+    lmap_del(child);
+  } else {
+    x->slots[i].node = child;
+  }
+  return x;
+}
+
+/* Returns NULL once the last key is removed */
+lnode* lmap_dissoc(lnode* node, unsigned long hash, lval* key, int* removed) {
+  return lmap_dissoc_at(node, hash, key, 0, removed);
+}
+
+/** Whole map operations **/
+
+/* Check every key of x is in y with an equal value, sizes are compared by the caller */
+int lmap_equal(lnode* x, lnode* y) {
+  for (int i = 0; i < x->count; i++) {
+    lslot* slot = &x->slots[i];
+    if (slot->node) {
+      if (!lmap_equal(slot->node, y)) { return 0; }
+    } else {
+      lval* val = lmap_get(y, slot->hash, slot->key);
+      if (!val || !lval_is_true(lval_eq(slot->val, val))) { return 0; }
+    }
+  }
+  return 1;
+}
+
+/* Hash of the contents that does not depend on their order */
+unsigned long lmap_hash(lnode* node) {
+  unsigned long hash = 0;
+  for (int i = 0; i < node->count; i++) {
+    lslot* slot = &node->slots[i];
+    hash += slot->node ? lmap_hash(slot->node) : slot->hash * 31 + lval_hash(slot->val);
+  }
+  return hash;
+}
+
+/* Add every key to list */
+lval* lmap_keys(lnode* node, lval* list) {
+  for (int i = 0; i < node->count; i++) {
+    lslot* slot = &node->slots[i];
+    list = slot->node ? lmap_keys(slot->node, list) : lval_add(list, lval_copy(slot->key));
+  }
+  return list;
+}
+
+/* Print each key and value, preceded by a space */
+void lmap_print(lnode* node) {
+  for (int i = 0; i < node->count; i++) {
+    lslot* slot = &node->slots[i];
+    if (slot->node) {
+      lmap_print(slot->node);
+    } else {
+      putchar(' '); lval_print(slot->key);
+      putchar(' '); lval_print(slot->val);
+    }
+  }
+}
+
+/* Visit every key and value */
+void lmap_each(lnode* node, void (*visit)(lval*)) {
+  for (int i = 0; i < node->count; i++) {
+    lslot* slot = &node->slots[i];
+    if (slot->node) {
+      lmap_each(slot->node, visit);
+    } else {
+      visit(slot->key);
+      visit(slot->val);
+    }
+  }
+}
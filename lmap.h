@@ -0,0 +1,49 @@
+#ifndef lmap_h
+#define lmap_h
+#include "builtin.h"
+#include "lenv.h"
+#include "lval.h"
+
+/*
+** Maps are hash array mapped tries. Each node indexes up to 32 slots
+** by the next 5 bits of the key hash, a bitmap recording which slots
+** are present. Nodes never change once built, an update copies the
+** nodes on the path to the key and shares every other one.
+*/
+typedef struct lnode lnode;
+typedef struct lslot lslot;
+
+/* A key and value, or a child node when key is NULL */
+struct lslot {
+  unsigned long hash;
+  struct lval* key;
+  struct lval* val;
+  lnode* node;
+};
+
+struct lnode {
+  int refs;
+
+  /* Slots present, unused once the hash runs out and keys are just listed */
+  unsigned int bitmap;
+  int count;
+  lslot slots[];
+};
+
+/* Hash bits consumed per level of the trie */
+#define LMAP_BITS 5
+
+lnode* lmap_retain(lnode* node);
+void lmap_del(lnode* node);
+struct lval* lmap_get(lnode* node, unsigned long hash, struct lval* key);
+lnode* lmap_assoc(lnode* node, unsigned long hash, struct lval* key, struct lval* val, int* added);
+lnode* lmap_dissoc(lnode* node, unsigned long hash, struct lval* key, int* removed);
+
+/* Whole map operations */
+int lmap_equal(lnode* x, lnode* y);
+unsigned long lmap_hash(lnode* node);
+struct lval* lmap_keys(lnode* node, struct lval* list);
+void lmap_print(lnode* node);
+void lmap_each(lnode* node, void (*visit)(struct lval*));
+
+#endif
@@ -0,0 +1,145 @@
+#include "lenv.h"
+#include "lval.h"
+#include "builtin.h"
+#include "lmemo.h"
+
+/* Buckets a new cache starts with */
+#define LMEMO_BUCKETS 16
+
+lmemo* lmemo_new(lval* fun, int capacity) {
+  lmemo* memo = malloc(sizeof(lmemo));
+  memo->fun = fun;
+  memo->capacity = capacity;
+  memo->count = 0;
+  memo->bucket_count = LMEMO_BUCKETS;
+  memo->buckets = calloc(LMEMO_BUCKETS, sizeof(lmemo_entry*));
+  memo->newest = NULL;
+  memo->oldest = NULL;
+  return memo;
+}
+
+void lmemo_del(lmemo* memo) {
+  lmemo_entry* entry = memo->newest;
+  while (entry) {
+    lmemo_entry* older = entry->older;
+    lval_del(entry->args);
+    lval_del(entry->result);
+    free(entry);
+    entry = older;
+  }
+  lval_del(memo->fun);
+  free(memo->buckets);
+  free(memo);
+}
+
+/** Recency list **/
+
+static void lmemo_unlink(lmemo* memo, lmemo_entry* entry) {
+  if (entry->newer) { entry->newer->older = entry->older; } else { memo->newest = entry->older; }
+  if (entry->older) { entry->older->newer = entry->newer; } else { memo->oldest = entry->newer; }
+}
+
+static void lmemo_push(lmemo* memo, lmemo_entry* entry) {
+  entry->newer = NULL;
+  entry->older = memo->newest;
+  if (memo->newest) { memo->newest->newer = entry; } else { memo->oldest = entry; }
+  memo->newest = entry;
+}
+
+/** Buckets **/
+
+static lmemo_entry** lmemo_bucket(lmemo* memo, unsigned long hash) {
+  return &memo->buckets[hash & (memo->bucket_count - 1)];
+}
+
+static lmemo_entry* lmemo_find(lmemo* memo, unsigned long hash, lval* args) {
+  for (lmemo_entry* entry = *lmemo_bucket(memo, hash); entry; entry = entry->next) {
+    if (entry->hash == hash && lval_is_true(lval_eq(entry->args, args))) { return entry; }
+  }
+  return NULL;
+}
+
+/* Double the buckets, keeping about one entry to each */
+static void lmemo_grow(lmemo* memo) {
+  lmemo_entry** old = memo->buckets;
+  int old_count = memo->bucket_count;
+
+  memo->bucket_count *= 2;
+  memo->buckets = calloc(memo->bucket_count, sizeof(lmemo_entry*));
+  for (int i = 0; i < old_count; i++) {
+    lmemo_entry* entry = old[i];
+    while (entry) {
+      lmemo_entry* next = entry->next;
+      lmemo_entry** bucket = lmemo_bucket(memo, entry->hash);
+      entry->next = *bucket;
+      *bucket = entry;
+      entry = next;
+    }
+  }
+  free(old);
+}
+
+/* Drop the least recently used entry */
+static void lmemo_evict(lmemo* memo) {
+  lmemo_entry* entry = memo->oldest;
+  lmemo_entry** link = lmemo_bucket(memo, entry->hash);
+  while (*link != entry) { link = &(*link)->next; }
+  *link = entry->next;
+
+  lmemo_unlink(memo, entry);
+  lval_del(entry->args);
+  lval_del(entry->result);
+  free(entry);
+  memo->count--;
+}
+
+static void lmemo_insert(lmemo* memo, unsigned long hash, lval* args, lval* result) {
+  if (memo->count == memo->capacity) { lmemo_evict(memo); }
+  if (memo->count == memo->bucket_count) { lmemo_grow(memo); }
+
+  lmemo_entry* entry = malloc(sizeof(lmemo_entry));
+  entry->hash = hash;
+  entry->args = args;
+  entry->result = lval_copy(result);
+
+  lmemo_entry** bucket = lmemo_bucket(memo, hash);
+  entry->next = *bucket;
+  *bucket = entry;
+  lmemo_push(memo, entry);
+  memo->count++;
+}
+
+lval* lmemo_call(lenv* env, lmemo* memo, lval* args) {
+  unsigned long hash = lval_hash(args);
+
+  /* Hits become the most recently used */
+  lmemo_entry* entry = lmemo_find(memo, hash, args);
+  if (entry) {
+    lmemo_unlink(memo, entry);
+    lmemo_push(memo, entry);
+    lval_del(args);
+    return lval_copy(entry->result);
+  }
+
+  /* The call consumes its arguments so the key is a copy of the list */
+  lval* key = lval_unshare(lval_copy(args));
+  lval* result = lval_call(env, memo->fun, args);
+
+  /* Errors are not remembered, the next call may succeed */
+  if (lval_type(result) == LVAL_ERR) {
+    lval_del(key);
+    return result;
+  }
+
+  lmemo_insert(memo, hash, key, result);
+  return result;
+}
+
+/* Visit the function and every cached argument list and result */
+void lmemo_each(lmemo* memo, void (*visit)(lval*)) {
+  visit(memo->fun);
+  for (lmemo_entry* entry = memo->newest; entry; entry = entry->older) {
+    visit(entry->args);
+    visit(entry->result);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef lmemo_h
+#define lmemo_h
+#include "builtin.h"
+#include "lenv.h"
+#include "lval.h"
+
+/*
+** Cache in front of a function made by memo. Results are found by
+** the hash of the argument list and checked with lval_eq. Entries
+** are also kept in a list from most to least recently used, the
+** least recent being dropped once the cache is full.
+*/
+typedef struct lmemo lmemo;
+typedef struct lmemo_entry lmemo_entry;
+
+struct lmemo_entry {
+  unsigned long hash;
+  struct lval* args;
+  struct lval* result;
+
+  /* Next entry in the same bucket */
+  lmemo_entry* next;
+
+  /* Neighbours in order of use */
+  lmemo_entry* newer;
+  lmemo_entry* older;
+};
+
+struct lmemo {
+  struct lval* fun;
+  int capacity;
+  int count;
+
+  /* Power of two number of buckets, grown with count */
+  int bucket_count;
+  lmemo_entry** buckets;
+
+  lmemo_entry* newest;
+  lmemo_entry* oldest;
+};
+
+/* Entries kept when memo is not given a capacity */
+#define LMEMO_CAPACITY 1024
+
+lmemo* lmemo_new(struct lval* fun, int capacity);
+void lmemo_del(lmemo* memo);
+struct lval* lmemo_call(struct lenv* env, lmemo* memo, struct lval* args);
+void lmemo_each(lmemo* memo, void (*visit)(struct lval*));
+
+#endif
@@ -0,0 +1,349 @@
+#include "lenv.h"
+#include "lval.h"
+#include "builtin.h"
+#include "lgc.h"
+#include "lread.h"
+
+#ifndef ROK_MPC
+
+static void lread_init(lreader* r, char* filename, char* input, size_t len) {
+  r->filename = filename;
+  r->start = input;
+  r->pos = input;
+  r->end = input + len;
+  r->row = 1;
+  r->col = 1;
+  r->file = NULL;
+  r->capacity = len;
+  r->depth = 0;
+  r->error = 0;
+  r->exprs = NULL;
+}
+
+/** Errors **/
+
+/*
+** Error naming what was expected at the current position. Unlike an
+** invalid number, which is read as an error value like any other, this
+** ends the input.
+*/
+static lval* lread_error(lreader* r, char* expected) {
+  r->error = 1;
+  int row = r->row, col = r->col;
+  for (char* p = r->start; p < r->pos; p++) {
+    if (*p == '\n') { row++; col = 1; } else { col++; }
+  }
+
+  if (r->pos == r->end) {
+    return lval_err("%s:%i:%i: error: expected %s at end of input",
+      r->filename, row, col, expected);
+  }
+  return lval_err("%s:%i:%i: error: expected %s at '%c'",
+    r->filename, row, col, expected, *r->pos);
+}
+
+/** Tokens **/
+
+static int lread_symbol_char(char c) {
+  return isalnum((unsigned char)c) || (c && strchr("_+-*/\\=<>!&%", c));
+}
+
+/* Whitespace and comments separate expressions and are otherwise ignored */
+static void lread_skip(lreader* r) {
+  while (r->pos < r->end) {
+    if (isspace((unsigned char)*r->pos)) {
+      r->pos++;
+    } else if (*r->pos == ';') {
+      while (r->pos < r->end && *r->pos != '\r' && *r->pos != '\n') { r->pos++; }
+    } else {
+      return;
+    }
+  }
+}
+
+/*
+** Length of the number at pos, or 0 if there is none. Each part is
+** matched greedily without backtracking, as the grammar's regex is,
+** so "1." is not a number.
+*/
+static int lread_number_len(lreader* r) {
+  char* p = r->pos;
+  if (p < r->end && (*p == '+' || *p == '-')) { p++; }
+
+  /* Optional whole part followed by a point */
+  char* q = p;
+  while (q < r->end && isdigit((unsigned char)*q)) { q++; }
+  if (q < r->end && *q == '.') { p = q + 1; }
+
+  if (p == r->end || !isdigit((unsigned char)*p)) { return 0; }
+  while (p < r->end && isdigit((unsigned char)*p)) { p++; }
+  return p - r->pos;
+}
+
+static lval* lread_number(lreader* r, int len) {
+  /* Copied out so strtol stops at the end of the token */
+  char small[LREAD_TOKEN];
+  char* token = len < LREAD_TOKEN ? small : malloc(len + 1);
+  memcpy(token, r->pos, len);
+  token[len] = '\0';
+  r->pos += len;
+
+  /* Like lval_read_num the fraction is dropped */
+  errno = 0;
+  long num = strtol(token, NULL, 10);
+  if (token != small) { free(token); }
+  return errno != ERANGE ?
+    lval_num(num) : lval_err("invalid number");
+}
+
+static int lread_keyword(lreader* r, char* word) {
+  size_t len = strlen(word);
+  if ((size_t)(r->end - r->pos) < len || strncmp(r->pos, word, len) != 0) { return 0; }
+  r->pos += len;
+  return 1;
+}
+
+static lval* lread_symbol(lreader* r) {
+  char* from = r->pos;
+  while (r->pos < r->end && lread_symbol_char(*r->pos)) { r->pos++; }
+
+  int len = r->pos - from;
+  char small[LREAD_TOKEN];
+  char* name = len < LREAD_TOKEN ? small : malloc(len + 1);
+  memcpy(name, from, len);
+  name[len] = '\0';
+
+  lval* sym = lval_sym(name);
+  if (name != small) { free(name); }
+  return sym;
+}
+
+/* Same escapes as mpcf_unescape, -1 for any other so the backslash is kept */
+static int lread_escape(char c) {
+  switch (c) {
+    case 'a': return '\a';
+    case 'b': return '\b';
+    case 'f': return '\f';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    case 'v': return '\v';
+    case '\\': return '\\';
+    case '\'': return '\'';
+    case '"': return '"';
+    case '0': return '\0';
+  }
+  return -1;
+}
+
+static lval* lread_string_literal(lreader* r) {
+  /* Find the closing quote, a backslash always takes the next byte with it */
+  char* from = r->pos + 1;
+  char* to = from;
+  while (to < r->end && *to != '"') { to += (*to == '\\' && to + 1 < r->end) ? 2 : 1; }
+  if (to == r->end) {
+    r->pos = to;
+    return lread_error(r, "'\"'");
+  }
+  r->pos = to + 1;
+
+  /* Unescaped text is never longer than the literal */
+  int len = to - from;
+  char small[LREAD_TOKEN];
+  char* text = len < LREAD_TOKEN ? small : malloc(len + 1);
+  char* out = text;
+  for (char* p = from; p < to; p++) {
+    char c = *p;
+    if (c == '\\' && p + 1 < to && lread_escape(p[1]) != -1) { c = lread_escape(*++p); }
+    *out++ = c;
+  }
+  *out = '\0';
+
+  lval* str = lval_str(text);
+  if (text != small) { free(text); }
+  return str;
+}
+
+/** Expressions **/
+
+static lval* lread_expr(lreader* r);
+
+static lval* lread_list(lreader* r, lval* x, char close) {
+  if (r->depth == LREAD_DEPTH) {
+    char expected[64];
+    snprintf(expected, sizeof(expected), "at most %i nested lists", LREAD_DEPTH);
+    lval_del(x);
+    return lread_error(r, expected);
+  }
+  r->pos++;
+  r->depth++;
+  while (1) {
+    lread_skip(r);
+    if (r->pos < r->end && *r->pos == close) {
+      r->pos++;
+      r->depth--;
+      return x;
+    }
+
+    /* The wrong bracket or running out of input */
+    if (r->pos == r->end || *r->pos == ')' || *r->pos == '}') {
+      lval_del(x);
+      return lread_error(r, close == ')' ? "')'" : "'}'");
+    }
+
+    lval* y = lread_expr(r);
+    if (r->error) {
+      lval_del(x);
+      return y;
+    }
+    x = lval_add(x, y);
+  }
+}
+
+/* Read the expression at pos, trying each kind in the grammar's order */
+static lval* lread_expr(lreader* r) {
+  int len = lread_number_len(r);
+  if (len) { return lread_number(r, len); }
+
+  if (lread_keyword(r, "true")) { return lval_bool(1); }
+  if (lread_keyword(r, "false")) { return lval_bool(0); }
+
+  char c = r->pos < r->end ? *r->pos : '\0';
+  if (lread_symbol_char(c)) { return lread_symbol(r); }
+  if (c == '"') { return lread_string_literal(r); }
+  if (c == '(') { return lread_list(r, lval_sexpr(), ')'); }
+  if (c == '{') { return lread_list(r, lval_qexpr(), '}'); }
+
+  return lread_error(r, "expression");
+}
+
+/** Input **/
+
+/* Move the unread input to the front of the buffer and read more after it */
+static void lread_fill(lreader* r) {
+  for (char* p = r->start; p < r->pos; p++) {
+    if (*p == '\n') { r->row++; r->col = 1; } else { r->col++; }
+  }
+  size_t kept = r->end - r->pos;
+  memmove(r->start, r->pos, kept);
+
+  /* Grow once a single expression takes up most of the buffer */
+  if (kept > r->capacity / 2) {
+    r->capacity *= 2;
+    r->start = realloc(r->start, r->capacity);
+  }
+
+  size_t n = fread(r->start + kept, 1, r->capacity - kept, r->file);
+  r->pos = r->start;
+  r->end = r->start + kept + n;
+  if (n == 0) {
+    fclose(r->file);
+    r->file = NULL;
+  }
+}
+
+int lread_open(lreader* r, char* filename) {
+  FILE* file = fopen(filename, "rb");
+  if (!file) { return 0; }
+  lread_init(r, filename, malloc(LREAD_CHUNK), 0);
+  r->file = file;
+  r->capacity = LREAD_CHUNK;
+  return 1;
+}
+
+void lread_close(lreader* r) {
+  if (r->file) { fclose(r->file); }
+  free(r->start);
+}
+
+/* Next top level expression, or NULL once the input is used up */
+lval* lread_next(lreader* r) {
+  while (1) {
+    char* from = r->pos;
+    lread_skip(r);
+    lval* x = r->pos < r->end ? lread_expr(r) : NULL;
+
+    /*
+    ** Lookahead goes at most one byte past an expression, so one that
+    ** ends any closer to the end of the buffer may read differently
+    ** once more of the file is in. Read it again after a refill.
+    */
+    if (!r->file || r->end - r->pos > 1) { return x; }
+    if (x) { lval_del(x); }
+    r->pos = from;
+    r->depth = 0;
+    r->error = 0;
+    lread_fill(r);
+  }
+}
+
+lval* lread_string(char* filename, char* input) {
+  lreader r;
+  lread_init(&r, filename, input, strlen(input));
+
+  lval* x = lval_sexpr();
+  lval* y;
+  while ((y = lread_next(&r))) {
+    if (r.error) {
+      lval_del(x);
+      return y;
+    }
+    x = lval_add(x, y);
+  }
+  return x;
+}
+
+#else
+#include "rok.h"
+
+/* Turn a failed parse into an error value */
+static lval* lread_mpc_error(mpc_result_t* result) {
+  char* msg = mpc_err_string(result->error);
+  mpc_err_delete(result->error);
+
+  /* Drop the trailing newline */
+  size_t len = strlen(msg);
+  if (len && msg[len-1] == '\n') { msg[len-1] = '\0'; }
+
+  lval* err = lval_err("%s", msg);
+  free(msg);
+  return err;
+}
+
+/*
+** The whole file is parsed up front, or just its error if it does not
+** parse. A file that cannot be opened is reported the same way.
+*/
+int lread_open(lreader* r, char* filename) {
+  mpc_result_t result;
+  r->error = !mpc_parse_contents(filename, Rok, &result);
+  if (!r->error) {
+    r->exprs = lval_read(result.output);
+    mpc_ast_delete(result.output);
+  } else {
+    r->exprs = lval_add(lval_sexpr(), lread_mpc_error(&result));
+  }
+
+  /* Held across the evaluation of each expression */
+  lgc_push(r->exprs);
+  return 1;
+}
+
+void lread_close(lreader* r) {
+  lgc_pop();
+  lval_del(r->exprs);
+}
+
+lval* lread_next(lreader* r) {
+  return r->exprs->count ? lval_pop(r->exprs, 0) : NULL;
+}
+
+lval* lread_string(char* filename, char* input) {
+  mpc_result_t result;
+  if (!mpc_parse(filename, input, Rok, &result)) { return lread_mpc_error(&result); }
+  lval* x = lval_read(result.output);
+  mpc_ast_delete(result.output);
+  return x;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef lread_h
+#define lread_h
+#include <stdio.h>
+#include "builtin.h"
+#include "lenv.h"
+#include "lval.h"
+
+/*
+** Reader for Rok source. It makes a single pass over the input and
+** builds values directly, accepting the same language as the grammar
+** in rok.c. That grammar and lval_read are still used in place of it
+** when built with -DROK_MPC.
+**
+** Files are read in chunks, so only the expression being read needs
+** to be in memory at once.
+*/
+typedef struct lreader lreader;
+
+struct lreader {
+  char* filename;
+
+  /* Input runs from start to end, pos is the next byte to read */
+  char* start;
+  char* pos;
+  char* end;
+
+  /* Line and column of start, for errors */
+  int row;
+  int col;
+
+  /* File the input is refilled from, NULL once it is used up */
+  FILE* file;
+  size_t capacity;
+
+  /* Lists open around pos, and whether a syntax error ended the input */
+  int depth;
+  int error;
+
+  /* Expressions left to hand out when parsed with mpc */
+  struct lval* exprs;
+};
+
+/* Tokens shorter than this are copied out of the input on the C stack */
+#define LREAD_TOKEN 64
+
+/* Bytes read from a file at a time */
+#define LREAD_CHUNK 65536
+
+/* Lists nested deeper than this are an error rather than a stack overflow */
+#define LREAD_DEPTH 10000
+
+int lread_open(lreader* r, char* filename);
+void lread_close(lreader* r);
+struct lval* lread_next(lreader* r);
+
+/* Every expression in the input as an S-Expression, or an error */
+struct lval* lread_string(char* filename, char* input);
+
+#endif
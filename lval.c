@@ -1,18 +1,30 @@
 #include "lenv.h"
 #include "lval.h"
 #include "builtin.h"
+#include "lalloc.h"
+#include "lcode.h"
+#include "lgc.h"
+#include "lmap.h"
+#include "lmemo.h"
 
 /** Lval functions **/
 lval* lval_num(long num) {
-  lval* val = malloc(sizeof(lval));
+  /* Numbers that fit are kept in the pointer itself */
+  if (num >= LVAL_FIXNUM_MIN && num <= LVAL_FIXNUM_MAX) {
+    return (lval*)(((uintptr_t)num << 1) | LVAL_TAG_FIXNUM);
+  }
+
+  lval* val = lval_alloc();
   val->type = LVAL_NUM;
+  val->refs = 1;
   val->num = num;
   return val;
 }
 
 lval* lval_err(char* fmt, ...) {
-  lval* val = malloc(sizeof(lval));
+  lval* val = lval_alloc();
   val->type = LVAL_ERR;
+  val->refs = 1;
 
   /* Create a va_list and initialize it */
   va_list va;
@@ -32,163 +44,303 @@ lval* lval_err(char* fmt, ...) {
 }
 
 lval* lval_sym(char* sym) {
-  lval* val = malloc(sizeof(lval));
+  lval* val = lval_alloc();
   val->type = LVAL_SYM;
-  val->sym = malloc(strlen(sym) + 1);
-  strcpy(val->sym, sym);
+  val->refs = 1;
+  val->hash = lenv_hash(sym);
+  val->sym = lenv_intern(sym, val->hash);
   return val;
 }
 
-lval* lval_bool(char* bool) {
-  lval* val = malloc(sizeof(lval));
-  val->type = LVAL_BOOL;
-  val->bool = malloc(strlen(bool) + 1);
-  strcpy(val->bool, bool);
-  return val;
+lval* lval_bool(int truth) {
+  return truth ? LVAL_TRUE : LVAL_FALSE;
 }
 
 lval* lval_str(char* str) {
-  lval* val = malloc(sizeof(lval));
+  lval* val = lval_alloc();
   val->type = LVAL_STR;
-  val->str = malloc(strlen(str) + 1);
-  strcpy(val->str, str);
+  val->refs = 1;
+
+  /* Keep short strings inline */
+  size_t len = strlen(str);
+  val->str = len < LVAL_SMALL_STR ? val->small : malloc(len + 1);
+  memcpy(val->str, str, len + 1);
+  return val;
+}
+
+lval* lval_map(void) {
+  lval* val = lval_alloc();
+  val->type = LVAL_MAP;
+  val->refs = 1;
+  val->map = NULL;
+  val->size = 0;
   return val;
 }
 
 lval* lval_sexpr(void) {
-  lval* val = malloc(sizeof(lval));
+  lval* val = lval_alloc();
   val->type = LVAL_SEXPR;
+  val->refs = 1;
   val->count = 0;
+  val->capacity = 0;
   val->cell = NULL;
+  val->start = 0;
   return val;
 }
 
 lval* lval_qexpr(void) {
-  lval* val = malloc(sizeof(lval));
+  lval* val = lval_alloc();
   val->type = LVAL_QEXPR;
+  val->refs = 1;
   val->count = 0;
+  val->capacity = 0;
   val->cell = NULL;
+  val->start = 0;
   return val;
 }
 
 lval* lval_fun(lbuiltin builtin) {
-  lval* val = malloc(sizeof(lval));
+  lval* val = lval_alloc();
   val->type = LVAL_FUN;
+  val->refs = 1;
   val->builtin = builtin;
+  val->lambda = NULL;
+  val->memo = NULL;
   return val;
 }
 
+/* Arguments already bound into two partially applied lambdas match */
+static int lval_env_eq(lenv* x, lenv* y) {
+  if (x->count != y->count) { return 0; }
+  for (int i = 0; i < x->count; i++) {
+    /* Arguments bind in the order of the formals so entries line up */
+    if (x->syms[i] != y->syms[i]) { return 0; }
+    if (!lval_is_true(lval_eq(x->vals[i], y->vals[i]))) { return 0; }
+  }
+  return 1;
+}
+
 lval* lval_eq(lval* x, lval* y) {
   /* Different types are always unequal */
-  if (x->type != y->type) { return lval_bool("false");}
-
+  if (lval_type(x) != lval_type(y)) { return lval_bool(0); }
 
   /* Compare based upon type */
-  switch (x->type) {
+  switch (lval_type(x)) {
     /* Compare Number Value */
-    case LVAL_NUM:
-      if (x->num == y->num) {
-        return lval_bool("true");
-      } else {
-        return lval_bool("false");
-      }
+    case LVAL_NUM: return lval_bool(lval_num_val(x) == lval_num_val(y));
+    /* Booleans are immediates and symbols interned so compare pointers */
+    case LVAL_BOOL: return lval_bool(x == y);
+    case LVAL_SYM: return lval_bool(x->sym == y->sym);
     /* Compare String Values */
-    case LVAL_BOOL:
-      if (strcmp(x->bool, y->bool) == 0) {
-        return lval_bool("true");
-      } else {
-        return lval_bool("false");
-      }
-    case LVAL_SYM:
-      if (strcmp(x->sym, y->sym) == 0) {
-        return lval_bool("true");
-      } else {
-        return lval_bool("false");
-      }
-    case LVAL_STR:
-      if (strcmp(x->str, y->str) == 0) {
-        return lval_bool("true");
-      } else {
-        return lval_bool("false");
-      }
-    case LVAL_ERR:
-      if (strcmp(x->err, y->err) == 0) {
-        return lval_bool("true");
-      } else {
-        return lval_bool("false");
-      }
-    /* If builtin compare, otherwise compare formals and body */
+    case LVAL_STR: return lval_bool(strcmp(x->str, y->str) == 0);
+    case LVAL_ERR: return lval_bool(strcmp(x->err, y->err) == 0);
+    /* If builtin or memo compare, otherwise formals, body and bound args */
     case LVAL_FUN:
-      if (x->builtin || y->builtin) {
-         if (x->builtin == y->builtin) {
-          return lval_bool("true");
-        } else {
-          return lval_bool("false");
-        }
+      if (x->memo || y->memo) {
+        return lval_bool(x->memo == y->memo);
+      } else if (x->builtin || y->builtin) {
+        return lval_bool(x->builtin == y->builtin);
       } else {
-        lval* formal_result = lval_eq(x->formals, y->formals);
-        lval* body_result = lval_eq(x->body, y->body);
-        return lval_eq(formal_result, body_result);
+        lval* formal_result = lval_eq(x->lambda->formals, y->lambda->formals);
+        lval* body_result = lval_eq(x->lambda->body, y->lambda->body);
+        return lval_bool(lval_is_true(formal_result) && lval_is_true(body_result)
+          && lval_env_eq(x->lambda->env, y->lambda->env));
       }
 
     /* If list compare every individual element */
     case LVAL_QEXPR:
     case LVAL_SEXPR:
       if (x->count != y->count) {
-        return lval_bool("false");
+        return lval_bool(0);
       } else {
         for (int i = 0; i < x->count; i++) {
           lval* result = lval_eq(x->cell[i], y->cell[i]);
-          if (strcmp(result->bool, "true") != 0) {
+          if (!lval_is_true(result)) {
             return result;
           }
         }
         /* Otherwise lists must be equal */
-        return lval_bool("true");
+        return lval_bool(1);
+      }
+    break;
+
+    /* Maps are equal if they hold equal values for the same keys */
+    case LVAL_MAP:
+      if (x->size != y->size) { return lval_bool(0); }
+      return lval_bool(x->size == 0 || lmap_equal(x->map, y->map));
+  }
+  return lval_bool(0);
+}
+
+/* Spread the bits of a hash so similar values land far apart */
+static unsigned long lval_mix(unsigned long hash) {
+  hash ^= hash >> 29;
+  hash *= (unsigned long)0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+/* Structural hash, values equal under lval_eq always hash the same */
+unsigned long lval_hash(lval* val) {
+  unsigned long hash = lval_type(val);
+  switch (lval_type(val)) {
+    case LVAL_NUM: hash = hash * 31 + (unsigned long)lval_num_val(val); break;
+    case LVAL_BOOL: hash = hash * 31 + lval_is_true(val); break;
+    case LVAL_SYM: hash = hash * 31 + val->hash; break;
+    case LVAL_STR: hash = hash * 31 + lenv_hash(val->str); break;
+    case LVAL_ERR: hash = hash * 31 + lenv_hash(val->err); break;
+    /* Hash whatever lval_eq compares for each kind of function */
+    case LVAL_FUN:
+      if (val->memo) {
+        hash = hash * 31 + (unsigned long)(uintptr_t)val->memo;
+      } else if (val->builtin) {
+        hash = hash * 31 + (unsigned long)(uintptr_t)val->builtin;
+      } else {
+        hash = hash * 31 + lval_hash(val->lambda->formals);
+        hash = hash * 31 + lval_hash(val->lambda->body);
+        for (int i = 0; i < val->lambda->env->count; i++) {
+          hash = hash * 31 + lval_hash(val->lambda->env->vals[i]);
+        }
       }
     break;
+    case LVAL_QEXPR:
+    case LVAL_SEXPR:
+      for (int i = 0; i < val->count; i++) {
+        hash = hash * 31 + lval_hash(val->cell[i]);
+      }
+    break;
+    case LVAL_MAP:
+      if (val->map) { hash = hash * 31 + lmap_hash(val->map); }
+    break;
+  }
+  return lval_mix(hash);
+}
+
+static int lval_is_slice(lval* val) {
+  return (val->type == LVAL_SEXPR || val->type == LVAL_QEXPR)
+    && val->capacity == LVAL_SLICE;
+}
+
+/* Give a slice cells of its own, with room for capacity of them */
+static void lval_own_cells(lval* val, int capacity) {
+  lval* owner = val->owner;
+  lval** cell = malloc(sizeof(lval*) * capacity);
+  for (int i = 0; i < val->count; i++) {
+    cell[i] = lval_copy(val->cell[i]);
   }
-  return lval_bool("false");
+  val->cell = cell;
+  val->capacity = capacity;
+  val->start = 0;
+  lval_del(owner);
 }
 
 lval* lval_add(lval* val, lval* x) {
-  val->count++;
-  val->cell = realloc(val->cell, sizeof(lval*) * val->count);
-  val->cell[val->count-1] = x;
+  val = lval_unshare(val);
+  lval_reserve(val, 1);
+  val->cell[val->count++] = x;
   return val;
 }
 
+/* Make room for extra more cells at the end */
+void lval_reserve(lval* val, int extra) {
+  int need = val->count + extra;
+  if (val->capacity == LVAL_SLICE) {
+    lval_own_cells(val, need > 4 ? need : 4);
+    return;
+  }
+  if (val->start + need <= val->capacity) { return; }
+
+  /* Slide back over popped cells if that frees up enough room */
+  lval** base = val->cell ? val->cell - val->start : NULL;
+  if (need <= val->capacity && val->start >= val->capacity / 2) {
+    memmove(base, val->cell, sizeof(lval*) * val->count);
+    val->cell = base;
+    val->start = 0;
+    return;
+  }
+
+  /* Otherwise grow geometrically so appends are amortized O(1) */
+  int capacity = val->capacity ? val->capacity * 2 : 4;
+  if (capacity < val->start + need) { capacity = val->start + need; }
+  base = realloc(base, sizeof(lval*) * capacity);
+  val->cell = base + val->start;
+  val->capacity = capacity;
+}
+
+/* Make room for extra more cells at the front */
+static void lval_reserve_front(lval* val, int extra) {
+  if (val->start >= extra) { return; }
+
+  /* Leave room for as many cells again so prepending is amortized O(1) */
+  int front = extra + val->count;
+  int capacity = front + val->count;
+  lval** base = malloc(sizeof(lval*) * capacity);
+  memcpy(base + front, val->cell, sizeof(lval*) * val->count);
+  lval_free_cells(val);
+  val->cell = base + front;
+  val->capacity = capacity;
+  val->start = front;
+}
+
+/* Free the cell array of an expression that owns one */
+void lval_free_cells(lval* val) {
+  if (val->capacity != LVAL_SLICE && val->cell) { free(val->cell - val->start); }
+}
+
 void lval_del(lval* val) {
+  /* Immediates own no memory, otherwise only the last holder frees */
+  if (lval_immediate(val)) { return; }
+#ifdef ROK_GC
+  if (lgc_sweeping) { return; }
+#endif
+  if (--val->refs > 0) { return; }
+
   switch (val->type) {
     /* Do nothing special for number type */
     case LVAL_NUM: break;
-    case LVAL_BOOL: break;
 
-    /* For err or sym free the data */
+    /* Symbol names are interned and live for the whole run */
+    case LVAL_SYM: break;
+
+    /* For err or str free the data */
     case LVAL_ERR: free(val->err); break;
-    case LVAL_SYM: free(val->sym); break;
-    case LVAL_STR: free(val->str); break;
+    case LVAL_STR:
+      if (val->str != val->small) { free(val->str); }
+    break;
     case LVAL_FUN:
-      if (!val->builtin) {
-        lenv_del(val->env);
-        lval_del(val->formals);
-        lval_del(val->body);
+      if (val->memo) {
+        lmemo_del(val->memo);
+      } else if (!val->builtin) {
+        lenv_del(val->lambda->env);
+        lval_del(val->lambda->formals);
+        lval_del(val->lambda->body);
+        if (val->lambda->code) { lcode_del(val->lambda->code); }
+        free(val->lambda);
       }
     break;
 
+    case LVAL_MAP:
+      if (val->map) { lmap_del(val->map); }
+    break;
+
     /* If qexpr or sexpr then delete all elements inside */
     case LVAL_QEXPR:
     case LVAL_SEXPR:
+      /* A slice only holds the expression it views */
+      if (val->capacity == LVAL_SLICE) {
+        lval_del(val->owner);
+        break;
+      }
       for (int i = 0; i < val->count; i++) {
         lval_del(val->cell[i]);
       }
 
       /* Free memory allocated to store pointers */
-      free(val->cell);
+      lval_free_cells(val);
     break;
   }
   /* Free memory allocated for the lval struct itself */
-  free(val);
+  lval_free(val);
 }
 
 lval* lval_read_num(mpc_ast_t* tree) {
@@ -212,7 +364,7 @@ lval* lval_read(mpc_ast_t* tree) {
   /* If symbol or number return conversion to that type */
   if (strstr(tree->tag, "number")) { return lval_read_num(tree); }
   if (strstr(tree->tag, "boolean")) {
-    return lval_bool(tree->contents);
+    return lval_bool(strcmp(tree->contents, "true") == 0);
   }
   if (strstr(tree->tag, "symbol")) { return lval_sym(tree->contents); }
 
@@ -254,24 +406,31 @@ void lval_expr_print(lval* val, char open, char close) {
 }
 
 void lval_print(lval* val) {
-  switch(val->type) {
+  switch(lval_type(val)) {
     /* In the case the type is a number print it */
     /* Then break out of the switch */
-    case LVAL_NUM: printf("%li", val->num); break;
+    case LVAL_NUM: printf("%li", lval_num_val(val)); break;
     case LVAL_ERR: printf("Error: %s", val->err); break;
     case LVAL_SYM: printf("%s", val->sym); break;
     case LVAL_STR: lval_print_str(val); break;
-    case LVAL_BOOL: printf("%s", val->bool); break;
+    case LVAL_BOOL: printf("%s", lval_is_true(val) ? "true" : "false"); break;
     case LVAL_FUN:
-      if (val->builtin) {
+      if (val->memo) {
+        printf("(memo "); lval_print(val->memo->fun); putchar(')');
+      } else if (val->builtin) {
         printf("<builtin>");
       } else {
-        printf("(\\ "); lval_print(val->formals);
-        putchar(' '); lval_print(val->body); putchar(')');
+        printf("(\\ "); lval_print(val->lambda->formals);
+        putchar(' '); lval_print(val->lambda->body); putchar(')');
       }
     break;
     case LVAL_SEXPR: lval_expr_print(val, '(', ')'); break;
     case LVAL_QEXPR: lval_expr_print(val, '{', '}'); break;
+    /* Maps print as the call that would build them */
+    case LVAL_MAP:
+      printf("(hash-map");
+      if (val->map) { lmap_print(val->map); }
+      putchar(')');
     break;
   }
 }
@@ -286,23 +445,49 @@ void lval_print_str(lval* val) {
 }
 
 lval* lval_pop(lval* val, int i) {
+  /* A slice can only give up its front cell without cells of its own */
+  if (val->capacity == LVAL_SLICE) {
+    if (i == 0) {
+      lval* x = lval_copy(val->cell[0]);
+      val->cell++;
+      val->count--;
+      return x;
+    }
+    lval_own_cells(val, val->count);
+  }
+
   /* Find the item at i */
   lval* x = val->cell[i];
 
-  /* Shift memory after the item at "i" over the top */
-  /* WTF is memmove? */
-  memmove(&val->cell[i], &val->cell[i+1],
-    sizeof(lval*) * (val->count-i-1));
+  if (i == 0) {
+    /* Popping the front only moves the start of the cells along */
+    val->cell++;
+    val->start++;
+  } else {
+    /* Shift memory after the item at "i" over the top */
+    memmove(&val->cell[i], &val->cell[i+1],
+      sizeof(lval*) * (val->count-i-1));
+  }
 
   /* Decrease the count of items in the list */
   val->count--;
 
-  /* Reallocate the memory used */
-  val->cell = realloc(val->cell, sizeof(lval*) * val->count);
+  /* Once empty the whole array is free again */
+  if (val->count == 0) {
+    val->cell -= val->start;
+    val->start = 0;
+  }
   return x;
 }
 
 lval* lval_take(lval* val, int i) {
+  /* Leave a shared list intact and share the item instead */
+  if (val->refs > 1) {
+    lval* x = lval_copy(val->cell[i]);
+    lval_del(val);
+    return x;
+  }
+
   lval* x = lval_pop(val, i);
   lval_del(val);
   return x;
@@ -310,76 +495,136 @@ lval* lval_take(lval* val, int i) {
 
 
 lval* lval_join(lval* x, lval* y) {
-  /* For each cell in 'y' add it to 'x' */
-  while(y->count) {
-    x = lval_add(x, lval_pop(y, 0));
+  /* Prepend onto 'y' instead when it is the longer one and ours alone */
+  if (y->refs == 1 && !lval_is_slice(y) && y->count > x->count) {
+    lval_reserve_front(y, x->count);
+    y->cell -= x->count;
+    y->start -= x->count;
+    y->count += x->count;
+    y->type = x->type;
+
+    int owned = x->refs == 1 && !lval_is_slice(x);
+    for (int i = 0; i < x->count; i++) {
+      y->cell[i] = owned ? x->cell[i] : lval_copy(x->cell[i]);
+    }
+    if (owned) { x->count = 0; }
+    lval_del(x);
+    return y;
   }
 
+  x = lval_unshare(x);
+  lval_reserve(x, y->count);
+
+  /* Move the cells of 'y' over if we hold it alone, otherwise share them */
+  int owned = y->refs == 1 && !lval_is_slice(y);
+  for (int i = 0; i < y->count; i++) {
+    x->cell[x->count++] = owned ? y->cell[i] : lval_copy(y->cell[i]);
+  }
+  if (owned) { y->count = 0; }
+
   /* Delete the empty y and return x */
   lval_del(y);
   return x;
 }
 
+/* View the cells of an expression from index from onwards without copying */
+lval* lval_slice(lval* val, int from) {
+  lval* x = lval_alloc();
+  x->type = val->type;
+  x->refs = 1;
+  x->count = val->count - from;
+  x->capacity = LVAL_SLICE;
+  x->cell = val->cell + from;
+  x->owner = lval_is_slice(val) ? lval_copy(val->owner) : lval_copy(val);
+  return x;
+}
+
 lval* lval_copy(lval* val) {
-  lval* x = malloc(sizeof(lval));
+  if (lval_immediate(val)) { return val; }
+
+  /* Copies share the value until one of them needs to change it */
+  val->refs++;
+  return val;
+}
+
+lval* lval_unshare(lval* val) {
+  /* Nothing to do for immediates or if we are the only holder */
+  if (lval_immediate(val)) { return val; }
+  if (val->refs == 1) {
+    if (lval_is_slice(val)) { lval_own_cells(val, val->count); }
+    return val;
+  }
+
+  /* Functions and maps never change */
+  if (val->type == LVAL_FUN || val->type == LVAL_MAP) { return val; }
+
+  lval* x = lval_alloc();
   x->type = val->type;
+  x->refs = 1;
 
   switch (val->type) {
     case LVAL_NUM: x->num = val->num; break;
-    case LVAL_FUN:
-      if (val->builtin) {
-        x->builtin = val->builtin;
-      } else {
-        x->builtin = NULL;
-        x->env = lenv_copy(val->env);
-        x->formals = lval_copy(val->formals);
-        x->body = lval_copy(val->body);
-      }
-    break;
     case LVAL_SYM:
-      x->sym = malloc(strlen(val->sym) + 1);
-      strcpy(x->sym, val->sym); break;
-    case LVAL_STR:
-      x->str = malloc(strlen(val->str) + 1);
-      strcpy(x->str, val->str); break;
-    case LVAL_BOOL:
-      x->bool = malloc(strlen(val->bool) + 1);
-      strcpy(x->bool, val->bool); break;
+      x->sym = val->sym;
+      x->hash = val->hash; break;
+    case LVAL_STR: {
+      size_t len = strlen(val->str);
+      x->str = len < LVAL_SMALL_STR ? x->small : malloc(len + 1);
+      memcpy(x->str, val->str, len + 1);
+    }
+    break;
 
     case LVAL_ERR:
       x->err = malloc(strlen(val->err) + 1);
       strcpy(x->err, val->err); break;
 
+    /* Cells stay shared, only the list itself is copied */
     case LVAL_SEXPR:
     case LVAL_QEXPR:
       x->count = val->count;
+      x->capacity = val->count;
       x->cell = malloc(sizeof(lval*) * x->count);
+      x->start = 0;
       for (int i = 0; i < x->count; i++) {
         x->cell[i] = lval_copy(val->cell[i]);
       }
     break;
   }
 
+  /* Give up our hold on the shared original */
+  val->refs--;
   return x;
 }
 
 lval* lval_lambda(lval* formals, lval* body) {
-  lval* val = malloc(sizeof(lval));
+  lval* val = lval_alloc();
   val->type = LVAL_FUN;
+  val->refs = 1;
 
   /* Set builtin to null */
   val->builtin = NULL;
+  val->memo = NULL;
+  val->lambda = malloc(sizeof(llambda));
 
   /* build new environment */
-  val->env = lenv_new();
+  val->lambda->env = lenv_new();
 
   /* set formals and body */
-  val->formals = formals;
-  val->body = body;
+  val->lambda->formals = formals;
+  val->lambda->body = body;
+
+  /* Compile the body once so calls skip the tree walk */
+#ifdef ROK_TREE_WALK
+  val->lambda->code = NULL;
+#else
+  val->lambda->code = lcode_compile(formals, body);
+#endif
   return val;
 }
 
 lval* lval_eval_sexpr(lenv* env, lval* val) {
+  /* Children are evaluated in place */
+  val = lval_unshare(val);
 
   /* Evaluate Children */
   for (int i = 0; i < val->count; i++) {
@@ -388,7 +633,7 @@ lval* lval_eval_sexpr(lenv* env, lval* val) {
 
   /* Error checking */
   for (int i = 0; i < val->count; i++) {
-    if (val->cell[i]->type == LVAL_ERR) { return lval_take(val, i); }
+    if (lval_type(val->cell[i]) == LVAL_ERR) { return lval_take(val, i); }
   }
 
   /* Empty Expression */
@@ -399,11 +644,11 @@ lval* lval_eval_sexpr(lenv* env, lval* val) {
 
   /* Ensure First Element is a function after evaluation */
   lval* fun = lval_pop(val, 0);
-  if (fun->type != LVAL_FUN) {
+  if (lval_type(fun) != LVAL_FUN) {
     lval* err = lval_err(
       "S-Expression starts with incorrect type. "
       "Got %s, Expected %s. ",
-      ltype_name(fun->type), ltype_name(LVAL_FUN));
+      ltype_name(lval_type(fun)), ltype_name(LVAL_FUN));
     lval_del(fun); lval_del(val);
     return err;
   }
@@ -415,99 +660,142 @@ lval* lval_eval_sexpr(lenv* env, lval* val) {
 }
 
 lval* lval_eval(lenv* env, lval* val) {
-  if (val->type == LVAL_SYM) {
+  if (lval_type(val) == LVAL_SYM) {
     lval* x = lenv_get(env, val);
     lval_del(val);
     return x;
   }
   /* Evaluate Sexpressions */
-  if (val->type == LVAL_SEXPR) { return lval_eval_sexpr(env, val); }
+  if (lval_type(val) == LVAL_SEXPR) {
+    LGC_ENTER();
+    val = lval_eval_sexpr(env, val);
+    LGC_LEAVE();
+    return val;
+  }
   /* All other lval types remain the same */
   return val;
 }
 
-lval* lval_call(lenv* env, lval* fun, lval* args) {
-  /* If Builtin then simply call that */
-  if (fun->builtin) { return fun->builtin(env, args); };
-
+/*
+** Bind arguments into a fresh frame for a lambda. The frame is returned
+** once every formal is bound, otherwise NULL is returned and result is
+** set to an error or to the partially applied function.
+*/
+lenv* lval_bind(lenv* env, lval* fun, lval* args, lval** result) {
   /* Record argument size */
   int given = args->count;
-  int total = fun->formals->count;
+  int total = fun->lambda->formals->count;
+
+  /* Bind into a fresh frame so the shared function is never modified */
+  lenv* frame = fun->lambda->env->count ? lenv_copy(fun->lambda->env) : lenv_new();
+  frame->parent = env;
+
+  /* Index of the next formal to bind */
+  int bound = 0;
 
   /* While arguments still remain to be processed */
   while (args->count) {
     /* If we've ran out of formal arguments to bind */
-    if (fun->formals->count == 0) {
-      lval_del(args); return lval_err(
+    if (bound == total) {
+      lenv_del(frame);
+      lval_del(args);
+      *result = lval_err(
         "Function passed too many arguments. "
         "Got %i, Expected %i",
         given, total);
+      return NULL;
     }
 
-    /* Pop the first symbol from the formals */
-    lval* sym = lval_pop(fun->formals, 0);
+    /* Take the next symbol from the formals */
+    lval* sym = fun->lambda->formals->cell[bound++];
 
     /* Special case to deal with '&' */
-    if (strcmp(sym->sym, "&") == 0) {
+    if (sym->sym == lenv_amp) {
       /* Ensure & is followed by another symbol */
-      if (fun->formals->count != 1) {
+      if (total - bound != 1) {
+        lenv_del(frame);
         lval_del(args);
-        return lval_err("Function format invalid. "
+        *result = lval_err("Function format invalid. "
           "Symbol '&' not followed by single symbol.");
+        return NULL;
       }
 
       /* Next formal should be bound to remaining arguments */
-      lval* nsym = lval_pop(fun->formals, 0);
-      lenv_put(fun->env, nsym, builtin_list(env, args));
-      lval_del(sym); lval_del(nsym);
+      lval* nsym = fun->lambda->formals->cell[bound++];
+      lenv_put(frame, nsym, builtin_list(env, args));
       break;
     }
 
     /* Pop the next argument from the list */
     lval* val = lval_pop(args, 0);
 
-    /* Bind a copy into the function's argument */
-    lenv_put(fun->env, sym, val);
-
-    /* Delete symbol and value */
-    lval_del(sym); lval_del(val);
+    /* Bind a copy into the frame */
+    lenv_put(frame, sym, val);
+    lval_del(val);
   }
 
   /* Argument list is now bound so can be cleared up */
   lval_del(args);
 
   /* If '&' remains in formal list bind to empty list */
-  if (fun->formals->count > 0 && strcmp(fun->formals->cell[0]->sym, "&") == 0) {
+  if (bound < total && fun->lambda->formals->cell[bound]->sym == lenv_amp) {
     /* Check to ensure that & is not passed invalidly. */
-    if (fun->formals->count != 2) {
-      return lval_err("Function format invalid. "
+    if (total - bound != 2) {
+      lenv_del(frame);
+      *result = lval_err("Function format invalid. "
         "Symbol '&' not followed by single symbol.");
+      return NULL;
     }
 
-    /* Pop and delete '&' symbol */
-    lval_del(lval_pop(fun->formals, 0));
-
-    /* Pop next symbol and create empty list */
-    lval* sym = lval_pop(fun->formals, 0);
+    /* Bind symbol after '&' to an empty list */
     lval* val = lval_qexpr();
+    lenv_put(frame, fun->lambda->formals->cell[bound+1], val);
+    lval_del(val);
+    bound += 2;
+  }
+
+  /* If all formals have been bound the frame is ready */
+  if (bound == total) { return frame; }
 
-    /* Bind to environment and delete */
-    lenv_put(fun->env, sym, val);
-    lval_del(sym); lval_del(val);
+  /* Otherwise return a partially applied function holding the frame */
+  frame->parent = NULL;
+  lval* formals = lval_qexpr();
+  for (int i = bound; i < total; i++) {
+    formals = lval_add(formals, lval_copy(fun->lambda->formals->cell[i]));
   }
 
-  /* If all formals have been bound evaluate */
-  if (fun->formals->count == 0) {
+  lval* partial = lval_alloc();
+  partial->type = LVAL_FUN;
+  partial->refs = 1;
+  partial->builtin = NULL;
+  partial->memo = NULL;
+  partial->lambda = malloc(sizeof(llambda));
+  partial->lambda->env = frame;
+  partial->lambda->formals = formals;
+  partial->lambda->body = lval_copy(fun->lambda->body);
+  partial->lambda->code = fun->lambda->code ? lcode_retain(fun->lambda->code) : NULL;
+  *result = partial;
+  return NULL;
+}
 
-    /* Set environment parent to evaluation environment */
-    fun->env->parent = env;
+lval* lval_call(lenv* env, lval* fun, lval* args) {
+  /* Memoized functions check their cache first */
+  if (fun->memo) { return lmemo_call(env, fun->memo, args); }
 
-    /* Evaluate and return */
-    return builtin_eval(fun->env, lval_add(lval_sexpr(), lval_copy(fun->body)));
-  } else {
-    /* Otherwise return partially evaluated function */
-    return lval_copy(fun);
-  }
+  /* If Builtin then simply call that */
+  if (fun->builtin) { return fun->builtin(env, args); };
+
+  lval* result;
+  lenv* frame = lval_bind(env, fun, args, &result);
+  if (!frame) { return result; }
+
+  /* Run compiled body if there is one, it takes over the frame */
+  if (fun->lambda->code) { return lcode_eval(frame, fun); }
+
+  /* Otherwise walk the tree */
+  result = builtin_eval(frame, lval_add(lval_sexpr(), lval_copy(fun->lambda->body)));
+  lenv_del(frame);
+  return result;
 }
 
 /* Print an "lval" followed by a newline */
@@ -524,6 +812,7 @@ char* ltype_name(int type) {
     case LVAL_STR: return "String";
     case LVAL_SEXPR: return "S-Expression";
     case LVAL_QEXPR: return "Q-Expression";
+    case LVAL_MAP: return "Map";
     default: return "Unknown";
   }
 }
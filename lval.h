@@ -1,6 +1,7 @@
 #ifndef lval_h
 #define lval_h
 
+#include <stdint.h>
 #include "mpc.h"
 #include "builtin.h"
 #include "lenv.h"
@@ -9,50 +10,145 @@
 typedef struct lval lval;
 struct lenv;
 typedef lval*(*lbuiltin)(struct lenv*, lval*);
+struct lcode;
+struct lnode;
+struct lmemo;
 
-struct lval {
-  int type;
-
-  /* Basic */
-  long num;
-  char* err;
-  char* sym;
-  char* bool;
-  char* str;
+/* Lambda data, shared by every copy of the function */
+typedef struct llambda llambda;
 
-  /* Function */
-  lbuiltin builtin;
+struct llambda {
   struct lenv* env;
   struct lval* formals;
   struct lval* body;
+  struct lcode* code;
+};
+
+/* Strings shorter than this are stored inside the lval itself */
+#define LVAL_SMALL_STR 16
+
+/* A type tag and reference count followed by the payload for that type */
+struct lval {
+  int type;
+
+  /* Number of holders, copies share until one of them mutates */
+  int refs;
+
+  union {
+    /* Basic, num only holds numbers too large to be a fixnum */
+    long num;
+    char* err;
+
+    /* Interned symbol name and its hash */
+    struct {
+      char* sym;
+      unsigned long hash;
+    };
 
-  /* Expression */
-  int count;
-  struct lval** cell;
+    /* String, points at small when short enough */
+    struct {
+      char* str;
+      char small[LVAL_SMALL_STR];
+    };
+
+    /*
+    ** Function, builtin is NULL for lambdas. A function made by memo
+    ** has neither and calls through its cache instead.
+    */
+    struct {
+      lbuiltin builtin;
+      llambda* lambda;
+      struct lmemo* memo;
+    };
+
+    /*
+    ** Expression, cell points start slots into an array with room
+    ** for capacity cells so popping the front just moves it along.
+    ** A slice has capacity LVAL_SLICE and views the cells of owner
+    ** instead, holding a reference to it rather than to each cell.
+    */
+    struct {
+      int count;
+      int capacity;
+      struct lval** cell;
+      union {
+        int start;
+        struct lval* owner;
+      };
+    };
+
+    /* Map, root is NULL when empty */
+    struct {
+      struct lnode* map;
+      int size;
+    };
+  };
 };
 
+/* Capacity of an expression that views the cells of another */
+#define LVAL_SLICE -1
+
 /* Declare Enumerations for lval types */
-enum lval_types { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_BOOL, LVAL_STR };
+enum lval_types { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_BOOL, LVAL_STR, LVAL_MAP };
+
+/*
+** Fixnums and booleans are immediates. Their value lives in the lval
+** pointer itself, tagged in the low bits, so they are never allocated
+** and copying or deleting them does nothing. Structs are at least
+** 8 byte aligned so real pointers always have these bits clear.
+*/
+#define LVAL_TAG_MASK   3
+#define LVAL_TAG_FIXNUM 1
+#define LVAL_TAG_BOOL   2
+
+#define LVAL_FIXNUM_MIN (INTPTR_MIN >> 1)
+#define LVAL_FIXNUM_MAX (INTPTR_MAX >> 1)
+
+#define LVAL_FALSE ((lval*)(uintptr_t)LVAL_TAG_BOOL)
+#define LVAL_TRUE  ((lval*)(uintptr_t)(LVAL_TAG_BOOL | 4))
+
+static inline int lval_immediate(lval* val) {
+  return ((uintptr_t)val & LVAL_TAG_MASK) != 0;
+}
+
+static inline int lval_type(lval* val) {
+  if ((uintptr_t)val & LVAL_TAG_FIXNUM) { return LVAL_NUM; }
+  if ((uintptr_t)val & LVAL_TAG_BOOL) { return LVAL_BOOL; }
+  return val->type;
+}
+
+static inline long lval_num_val(lval* val) {
+  if ((uintptr_t)val & LVAL_TAG_FIXNUM) { return (long)((intptr_t)val >> 1); }
+  return val->num;
+}
+
+static inline int lval_is_true(lval* val) { return val == LVAL_TRUE; }
 
 
 /* Create lval declarations */
 lval* lval_num(long num);
 lval* lval_err(char* fmt, ...);
 lval* lval_sym(char* sym);
-lval* lval_bool(char* bool);
+lval* lval_bool(int truth);
 lval* lval_sexpr(void);
 lval* lval_qexpr(void);
 lval* lval_fun(lbuiltin fun);
 lval* lval_str(char* str);
+lval* lval_map(void);
 
 /* lval operations */
 lval* lval_add(lval* val, lval* x);
+void lval_reserve(lval* val, int extra);
+void lval_free_cells(lval* val);
 void lval_del(lval* val);
 lval* lval_pop(lval* val, int index);
 lval* lval_take(lval* val, int index);
 lval* lval_join(lval* x, lval* y);
+lval* lval_slice(lval* val, int from);
 lval* lval_copy(lval* val);
+lval* lval_unshare(lval* val);
 lval* lval_eq(lval* x, lval* y);
+unsigned long lval_hash(lval* val);
 
 
 /* Read, Evaluate, Print functions */
@@ -68,6 +164,7 @@ void lval_print_str(lval* val);
 
 /* Function creation and calling */
 lval* lval_lambda(lval* formals, lval* body);
+struct lenv* lval_bind(struct lenv* env, lval* fun, lval* args, lval** result);
 lval* lval_call(struct lenv* env, lval* func, lval* args);
 
 /* utils */
@@ -1,5 +1,19 @@
 #include "mpc.h"
 
+/*
+** Files are mapped rather than read where mmap exists. A mapped file is
+** assumed not to shrink while it is parsed: reading past its new end
+** raises SIGBUS rather than an error. Define MPC_NO_MMAP to always read
+** files through stdio instead.
+*/
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(MPC_NO_MMAP)
+#define MPC_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 /*
 ** State Type
 */
@@ -28,10 +42,10 @@ static mpc_state_t mpc_state_new(void) {
 ** In mpc the input type has three modes of 
 ** operation: String, File and Pipe.
 **
-** String is easy. The whole contents are 
-** loaded into a buffer and scanned through.
-** The cursor can jump around at will making 
-** backtracking easy.
+** String is easy. The caller's buffer is 
+** scanned through in place, its length found
+** once up front. The cursor can jump around at
+** will making backtracking easy.
 **
 ** The second is a File which is also somewhat
 ** easy. The contents are never loaded into 
@@ -53,12 +67,18 @@ static mpc_state_t mpc_state_new(void) {
 ** backtracking and make LL(1) grammars easy
 ** to parse for all input methods.
 **
+** Where it is available `mpc_parse_contents` 
+** uses a fourth mode, Mmap. The file is mapped
+** into memory and scanned just like a String
+** without being copied or read through stdio.
+**
 */
 
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 2,
+  MPC_INPUT_MMAP   = 3
 };
 
 enum {
@@ -69,10 +89,73 @@ enum {
   MPC_INPUT_MEM_NUM = 512
 };
 
-typedef struct {
+enum {
+  MPC_INPUT_MEMO_MIN = 256
+};
+
+typedef union mpc_mem_t {
+  union mpc_mem_t *next;
   char mem[64];
 } mpc_mem_t;
 
+/*
+** Once the slots on the input are used up more
+** come from chunks, each twice the size of the
+** one before, so there are only ever a few to
+** look through when freeing.
+*/
+
+typedef struct mpc_mem_chunk_t {
+  struct mpc_mem_chunk_t *next;
+  size_t num;
+  mpc_mem_t *mem;
+} mpc_mem_chunk_t;
+
+/*
+** Packrat Memo
+**
+** Inside `mpc_packrat` the outcome of running a
+** combinatory parser at some position is kept in
+** a table on the input, so trying it there again
+** from another alternative does not redo the work.
+**
+** Failures are kept as a copy of their error and
+** can be given back any number of times. Results
+** cannot be copied, so the only successes kept are
+** those a sequence throws away when it fails part
+** way through. Each is given back once, to the next
+** alternative which tries the same parser there.
+**
+** The table is only used for inputs which can be
+** jumped around freely, String and Mmap.
+*/
+
+typedef struct {
+  mpc_state_t state;
+  char last;
+} mpc_mark_t;
+
+typedef struct {
+  mpc_parser_t *parser;
+  long pos;
+  char suppress;
+  char success;
+  mpc_err_t *error;
+  mpc_val_t *output;
+  mpc_dtor_t dtor;
+  mpc_mark_t end;
+} mpc_memo_t;
+
+typedef struct {
+  mpc_parser_t *p;
+  char entered;
+  char memo;
+  int j, end;
+  int base;
+  int *dispatch;
+  mpc_mark_t *starts;
+} mpc_frame_t;
+
 typedef struct {
 
   int type;
@@ -80,6 +163,7 @@ typedef struct {
   mpc_state_t state;
   
   char *string;
+  long length;
   char *buffer;
   FILE *file;
   
@@ -92,8 +176,22 @@ typedef struct {
   char *lasts;
   char last;
   
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
+  int packrat;
+  int memo_slots;
+  int memo_num;
+  mpc_memo_t *memo;
+  
+  int frames_slots;
+  int frames_num;
+  mpc_frame_t *frames;
+  int results_slots;
+  int results_num;
+  mpc_result_t *results;
+  
+  mpc_mem_t *mem_free;
+  mpc_mem_t *mem_next;
+  mpc_mem_t *mem_end;
+  mpc_mem_chunk_t *mem_chunks;
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
   
 } mpc_input_t;
@@ -108,8 +206,8 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = (char*)string;
+  i->length = strlen(string);
   i->buffer = NULL;
   i->file = NULL;
   
@@ -121,14 +219,29 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->packrat = 0;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo = NULL;
+  
+  i->frames_slots = 0;
+  i->frames_num = 0;
+  i->frames = NULL;
+  i->results_slots = 0;
+  i->results_num = 0;
+  i->results = NULL;
+  
+  i->mem_free = NULL;
+  i->mem_next = i->mem;
+  i->mem_end = i->mem + MPC_INPUT_MEM_NUM;
+  i->mem_chunks = NULL;
   
   return i;
 }
 
 static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
 
+  const char *end;
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
   i->filename = malloc(strlen(filename) + 1);
@@ -137,9 +250,10 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   
   i->state = mpc_state_new();
   
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
+  /* Like a copy with strncpy the input ends at any null before length */
+  end = memchr(string, '\0', length);
+  i->string = (char*)string;
+  i->length = end ? end - string : (long)length;
   i->buffer = NULL;
   i->file = NULL;
   
@@ -151,8 +265,22 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->packrat = 0;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo = NULL;
+  
+  i->frames_slots = 0;
+  i->frames_num = 0;
+  i->frames = NULL;
+  i->results_slots = 0;
+  i->results_num = 0;
+  i->results = NULL;
+  
+  i->mem_free = NULL;
+  i->mem_next = i->mem;
+  i->mem_end = i->mem + MPC_INPUT_MEM_NUM;
+  i->mem_chunks = NULL;
   
   return i;
 
@@ -169,6 +297,7 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = pipe;
   
@@ -180,8 +309,22 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->packrat = 0;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo = NULL;
+  
+  i->frames_slots = 0;
+  i->frames_num = 0;
+  i->frames = NULL;
+  i->results_slots = 0;
+  i->results_num = 0;
+  i->results = NULL;
+  
+  i->mem_free = NULL;
+  i->mem_next = i->mem;
+  i->mem_end = i->mem + MPC_INPUT_MEM_NUM;
+  i->mem_chunks = NULL;
   
   return i;
   
@@ -197,6 +340,7 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = file;
   
@@ -208,48 +352,164 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->packrat = 0;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo = NULL;
+  
+  i->frames_slots = 0;
+  i->frames_num = 0;
+  i->frames = NULL;
+  i->results_slots = 0;
+  i->results_num = 0;
+  i->results = NULL;
+  
+  i->mem_free = NULL;
+  i->mem_next = i->mem;
+  i->mem_end = i->mem + MPC_INPUT_MEM_NUM;
+  i->mem_chunks = NULL;
+  
+  return i;
+}
+
+#ifdef MPC_MMAP
+
+/*
+** Input over a regular file mapped read only. Pipes, devices and empty
+** files give NULL, so the caller reads them through stdio instead.
+*/
+static mpc_input_t *mpc_input_new_mmap(const char *filename) {
+  
+  mpc_input_t *i;
+  struct stat st;
+  void *data;
+  int fd = open(filename, O_RDONLY);
+  
+  if (fd == -1) { return NULL; }
+  
+  /* Empty files cannot be mapped and other kinds of file may not be */
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) { return NULL; }
+  
+  i = malloc(sizeof(mpc_input_t));
+  
+  i->filename = malloc(strlen(filename) + 1);
+  strcpy(i->filename, filename);
+  i->type = MPC_INPUT_MMAP;
+  
+  i->state = mpc_state_new();
+  
+  i->string = data;
+  i->length = st.st_size;
+  i->buffer = NULL;
+  i->file = NULL;
+  
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+  
+  i->packrat = 0;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo = NULL;
+  
+  i->frames_slots = 0;
+  i->frames_num = 0;
+  i->frames = NULL;
+  i->results_slots = 0;
+  i->results_num = 0;
+  i->results = NULL;
+  
+  i->mem_free = NULL;
+  i->mem_next = i->mem;
+  i->mem_end = i->mem + MPC_INPUT_MEM_NUM;
+  i->mem_chunks = NULL;
   
   return i;
 }
 
+#endif
+
 static void mpc_input_delete(mpc_input_t *i) {
   
+  mpc_mem_chunk_t *c;
+  
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+#ifdef MPC_MMAP
+  if (i->type == MPC_INPUT_MMAP) { munmap(i->string, i->length); }
+#endif
   
   free(i->marks);
   free(i->lasts);
+  free(i->memo);
+  free(i->frames);
+  free(i->results);
+  
+  while (i->mem_chunks) {
+    c = i->mem_chunks;
+    i->mem_chunks = c->next;
+    free(c->mem);
+    free(c);
+  }
+  
   free(i);
 }
 
 static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+  
+  mpc_mem_chunk_t *c;
+  
+  if ((char*)p >= (char*)(i->mem)
+  &&  (char*)p <  (char*)(i->mem + MPC_INPUT_MEM_NUM)) { return 1; }
+  
+  for (c = i->mem_chunks; c; c = c->next) {
+    if ((char*)p >= (char*)(c->mem)
+    &&  (char*)p <  (char*)(c->mem + c->num)) { return 1; }
+  }
+  
+  return 0;
+}
+
+static void mpc_mem_grow(mpc_input_t *i) {
+  mpc_mem_chunk_t *c = malloc(sizeof(mpc_mem_chunk_t));
+  c->num = i->mem_chunks ? i->mem_chunks->num * 2 : MPC_INPUT_MEM_NUM;
+  c->mem = malloc(sizeof(mpc_mem_t) * c->num);
+  c->next = i->mem_chunks;
+  i->mem_chunks = c;
+  i->mem_next = c->mem;
+  i->mem_end = c->mem + c->num;
 }
 
+/*
+** Freed slots are reused first, then those not
+** handed out yet from the newest chunk.
+*/
+
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
+  mpc_mem_t *p;
   
   if (n > sizeof(mpc_mem_t)) { return malloc(n); }
   
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  if (i->mem_free) {
+    p = i->mem_free;
+    i->mem_free = p->next;
+    return p;
+  }
   
-  return malloc(n);
+  if (i->mem_next == i->mem_end) { mpc_mem_grow(i); }
+  return i->mem_next++;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -259,10 +519,10 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
+  mpc_mem_t *q = p;
   if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  q->next = i->mem_free;
+  i->mem_free = q;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
@@ -296,6 +556,9 @@ static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 static void mpc_input_suppress_disable(mpc_input_t *i) { i->suppress--; }
 static void mpc_input_suppress_enable(mpc_input_t *i) { i->suppress++; }
 
+static void mpc_input_packrat_disable(mpc_input_t *i) { i->packrat--; }
+static void mpc_input_packrat_enable(mpc_input_t *i) { i->packrat++; }
+
 static void mpc_input_mark(mpc_input_t *i) {
   
   if (i->backtrack < 1) { return; }
@@ -362,9 +625,10 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_MMAP && i->state.pos == i->length) { return 1; }
   return 0;
 }
 
@@ -374,7 +638,9 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP:
+      return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
@@ -397,7 +663,9 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP:
+      return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -432,7 +700,8 @@ static char mpc_input_peekc(mpc_input_t *i) {
 static int mpc_input_failure(mpc_input_t *i, char c) {
 
   switch (i->type) {
-    case MPC_INPUT_STRING: { break; }
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: { break; }
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
     case MPC_INPUT_PIPE: {
       
@@ -703,6 +972,29 @@ static mpc_err_t *mpc_err_export(mpc_input_t *i, mpc_err_t *x) {
   return mpc_export(i, x);
 }
 
+static mpc_err_t *mpc_err_copy(mpc_input_t *i, mpc_err_t *x) {
+  int j;
+  mpc_err_t *y;
+  if (x == NULL) { return NULL; }
+  y = mpc_malloc(i, sizeof(mpc_err_t));
+  y->state = x->state;
+  y->filename = mpc_malloc(i, strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  y->expected_num = x->expected_num;
+  y->expected = x->expected_num ? mpc_malloc(i, sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = mpc_malloc(i, strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  y->failure = NULL;
+  if (x->failure) {
+    y->failure = mpc_malloc(i, strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  y->recieved = x->recieved;
+  return y;
+}
+
 static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
   int j;
   (void)i;
@@ -882,7 +1174,10 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_PACKRAT   = 25,
+  MPC_TYPE_DFA       = 26
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -896,9 +1191,11 @@ typedef struct { char *x; } mpc_pdata_string_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
+typedef struct { mpc_parser_t *x; } mpc_pdata_packrat_t;
+typedef struct { mpc_parser_t *x; int n; char *accept; int *trans; } mpc_pdata_dfa_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; int *dispatch; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
 
 typedef union {
@@ -913,6 +1210,8 @@ typedef union {
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_predict_t predict;
+  mpc_pdata_packrat_t packrat;
+  mpc_pdata_dfa_t dfa;
   mpc_pdata_not_t not;
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
@@ -996,22 +1295,336 @@ static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   d(mpc_export(i, x));
 }
 
+/*
+** Regex DFA Input
+**
+** A DFA runs straight over the input held in
+** memory, keeping the longest match. The state
+** is only touched once the match is known, so
+** there is nothing to mark or rewind. It has no
+** errors to give, so is only used when they are
+** suppressed.
+*/
+
+static int mpc_input_dfa_on(mpc_input_t *i) {
+  return i->backtrack > 0 && i->suppress > 0
+    && (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP);
+}
+
+static int mpc_input_dfa(mpc_input_t *i, mpc_pdata_dfa_t *d, char **o) {
+  
+  const unsigned char *s = (const unsigned char*)i->string + i->state.pos;
+  long len = i->length - i->state.pos;
+  long j, k, n = d->accept[1] ? 0 : -1;
+  int q = 1;
+  
+  for (j = 0; j < len; j++) {
+    q = d->trans[q * 256 + s[j]];
+    if (q == 0) { break; }
+    n = d->accept[q] ? j + 1 : n;
+  }
+  
+  if (n == -1) { return 0; }
+  
+  /* Folded strings lose any null chars */
+  *o = mpc_malloc(i, n + 1);
+  for (j = 0, k = 0; j < n; j++) {
+    if (s[j]) { (*o)[k++] = s[j]; }
+    i->state.col++;
+    if (s[j] == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+  }
+  (*o)[k] = '\0';
+  
+  if (n > 0) { i->last = s[n-1]; }
+  i->state.pos += n;
+  return 1;
+}
+
+/*
+** An alternative that can not start with the
+** next char is skipped without being run. This
+** loses its error, so is only done when errors
+** are suppressed.
+*/
+
+static int mpc_input_dispatch_on(mpc_input_t *i) {
+  return i->suppress > 0
+    && (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP)
+    && i->state.pos < i->length;
+}
+
+/*
+** Packrat Memo Table
+*/
+
+static int mpc_input_memo_on(mpc_input_t *i) {
+  return i->packrat > 0 && i->backtrack > 0
+    && (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP);
+}
+
+/* Primitives are cheaper to run again than to look up */
+static int mpc_memo_worth(mpc_parser_t *p) {
+  return p->type == MPC_TYPE_EXPECT
+    || (p->type >= MPC_TYPE_APPLY && p->type <= MPC_TYPE_PACKRAT);
+}
+
+/*
+** The grammar builds new parsers around a rule
+** every place it is used, such as to tag it or
+** to record its state. These wrappers are told
+** apart by what they are built around, so that
+** two built the same way share entries.
+*/
+
+static mpc_parser_t *mpc_memo_inner(mpc_parser_t *p) {
+  int j;
+  
+  if (p->retained) { return NULL; }
+  
+  switch (p->type) {
+    case MPC_TYPE_APPLY:    return p->data.apply.x;
+    case MPC_TYPE_APPLY_TO: return p->data.apply_to.x;
+    case MPC_TYPE_EXPECT:   return p->data.expect.x;
+    case MPC_TYPE_AND:
+      if (p->data.and.n == 0) { return NULL; }
+      for (j = 0; j < p->data.and.n-1; j++) {
+        if (p->data.and.xs[j]->type != MPC_TYPE_STATE) { return NULL; }
+      }
+      return p->data.and.xs[p->data.and.n-1];
+  }
+  
+  return NULL;
+}
+
+static int mpc_memo_same(mpc_parser_t *a, mpc_parser_t *b) {
+  int j;
+  
+  while (a != b) {
+    
+    if (a->type != b->type) { return 0; }
+    
+    switch (a->type) {
+      case MPC_TYPE_APPLY:
+        if (a->data.apply.f != b->data.apply.f) { return 0; }
+        break;
+      case MPC_TYPE_APPLY_TO:
+        if (a->data.apply_to.f != b->data.apply_to.f
+        ||  a->data.apply_to.d != b->data.apply_to.d) { return 0; }
+        break;
+      case MPC_TYPE_EXPECT:
+        if (strcmp(a->data.expect.m, b->data.expect.m) != 0) { return 0; }
+        break;
+      case MPC_TYPE_AND:
+        if (a->data.and.n != b->data.and.n
+        ||  a->data.and.f != b->data.and.f) { return 0; }
+        for (j = 0; j < a->data.and.n-1; j++) {
+          if (a->data.and.dxs[j] != b->data.and.dxs[j]) { return 0; }
+        }
+        break;
+    }
+    
+    a = mpc_memo_inner(a);
+    b = mpc_memo_inner(b);
+    if (a == NULL || b == NULL) { return 0; }
+  }
+  
+  return 1;
+}
+
+static mpc_memo_t *mpc_input_memo_slot(mpc_input_t *i, mpc_parser_t *p, long pos) {
+  size_t h = (size_t)pos;
+  mpc_parser_t *q;
+  while ((q = mpc_memo_inner(p))) { p = q; h += 7; }
+  h += ((size_t)p >> 4) * 31;
+  return &i->memo[h % i->memo_slots];
+}
+
+static void mpc_input_memo_drop(mpc_input_t *i, mpc_memo_t *m) {
+  if (m->parser == NULL) { return; }
+  if (m->success) {
+    mpc_parse_dtor(i, m->dtor, m->output);
+  } else {
+    mpc_err_delete_internal(i, m->error);
+  }
+  m->parser = NULL;
+  i->memo_num--;
+}
+
+/*
+** Backtracking never goes further back than the
+** earliest mark, so any entry before it can not
+** be reached again.
+*/
+static void mpc_input_memo_purge(mpc_input_t *i, int all) {
+  int j;
+  long from = i->marks_num > 0 ? i->marks[0].pos : i->state.pos;
+  for (j = 0; j < i->memo_slots && i->memo_num > 0; j++) {
+    if (i->memo[j].parser && (all || i->memo[j].pos < from)) {
+      mpc_input_memo_drop(i, &i->memo[j]);
+    }
+  }
+}
+
+/* Entries which land in the same slot of the bigger table are dropped */
+static void mpc_input_memo_grow(mpc_input_t *i) {
+  int j;
+  mpc_memo_t *m;
+  mpc_memo_t *old = i->memo;
+  int old_slots = i->memo_slots;
+  
+  i->memo_slots = old_slots ? old_slots * 2 : MPC_INPUT_MEMO_MIN;
+  i->memo = calloc(i->memo_slots, sizeof(mpc_memo_t));
+  
+  for (j = 0; j < old_slots; j++) {
+    if (old[j].parser == NULL) { continue; }
+    m = mpc_input_memo_slot(i, old[j].parser, old[j].pos);
+    if (m->parser) {
+      mpc_input_memo_drop(i, &old[j]);
+    } else {
+      *m = old[j];
+    }
+  }
+  
+  free(old);
+}
+
+/* Each slot holds one entry, whatever was there before is dropped */
+static mpc_memo_t *mpc_input_memo_new(mpc_input_t *i, mpc_parser_t *p, long pos) {
+  mpc_memo_t *m;
+  
+  /* Once half full clear out what is unreachable, and grow if that is not enough */
+  if (i->memo_num >= i->memo_slots / 2) {
+    mpc_input_memo_purge(i, 0);
+    if (i->memo_num >= i->memo_slots / 4) { mpc_input_memo_grow(i); }
+  }
+  
+  m = mpc_input_memo_slot(i, p, pos);
+  mpc_input_memo_drop(i, m);
+  m->parser = p;
+  m->pos = pos;
+  m->suppress = i->suppress > 0;
+  i->memo_num++;
+  return m;
+}
+
+/* Called once the input is back where p started */
+static void mpc_input_memo_fail(mpc_input_t *i, mpc_parser_t *p, mpc_err_t *x) {
+  mpc_memo_t *m = mpc_input_memo_new(i, p, i->state.pos);
+  m->success = 0;
+  m->error = x ? mpc_err_export(i, mpc_err_copy(i, x)) : NULL;
+}
+
+static void mpc_input_memo_stash(mpc_input_t *i, mpc_parser_t *p,
+  mpc_mark_t *start, mpc_mark_t *end, mpc_val_t *x, mpc_dtor_t d) {
+  mpc_memo_t *m;
+  if (!mpc_memo_worth(p)) { mpc_parse_dtor(i, d, x); return; }
+  m = mpc_input_memo_new(i, p, start->state.pos);
+  m->success = 1;
+  m->output = mpc_export(i, x);
+  m->dtor = d;
+  m->end = *end;
+}
+
+/* 1 or 0 for a remembered success or failure, -1 if there is neither */
+static int mpc_input_memo_find(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+  mpc_memo_t *m;
+  if (i->memo_num == 0) { return -1; }
+  m = mpc_input_memo_slot(i, p, i->state.pos);
+  if (m->parser == NULL
+  ||  m->pos != i->state.pos
+  || !mpc_memo_same(m->parser, p)
+  ||  m->suppress != (i->suppress > 0)) { return -1; }
+  
+  if (!m->success) {
+    r->error = mpc_err_copy(i, m->error);
+    return 0;
+  }
+  
+  r->output = m->output;
+  i->state = m->end.state;
+  i->last = m->end.last;
+  m->parser = NULL;
+  i->memo_num--;
+  return 1;
+}
+
+/*
+** Parse Stack
+**
+** Parsers are run by a loop over a stack of
+** frames kept on the input, not by recursing in
+** C, so how deep the input nests is only limited
+** by memory. A frame is a parser that has been
+** entered and is waiting on one of its parts.
+** When that part is done the frame is resumed
+** with what it gave.
+**
+** The results a frame keeps from its parts go on
+** a second stack, above those of the frame below
+** it. Once the frame is done they are popped with
+** it and the frame below is resumed.
+*/
+
 enum {
-  MPC_PARSE_STACK_MIN = 4
+  MPC_PARSE_STACK_MIN = 64
 };
 
+static void mpc_parse_push(mpc_input_t *i, mpc_parser_t *p) {
+  
+  mpc_frame_t *f;
+  
+  if (i->frames_num == i->frames_slots) {
+    i->frames_slots = i->frames_slots ? i->frames_slots * 2 : MPC_PARSE_STACK_MIN;
+    i->frames = realloc(i->frames, sizeof(mpc_frame_t) * i->frames_slots);
+  }
+  
+  f = &i->frames[i->frames_num++];
+  f->p = p;
+  f->entered = 0;
+  f->base = i->results_num;
+}
+
+static void mpc_parse_keep(mpc_input_t *i, mpc_result_t *r) {
+  if (i->results_num == i->results_slots) {
+    i->results_slots = i->results_slots ? i->results_slots * 2 : MPC_PARSE_STACK_MIN;
+    i->results = realloc(i->results, sizeof(mpc_result_t) * i->results_slots);
+  }
+  i->results[i->results_num++] = *r;
+}
+
+static mpc_val_t **mpc_parse_kept(mpc_input_t *i, mpc_frame_t *f) {
+  return (mpc_val_t**)(i->results + f->base);
+}
+
 #define MPC_SUCCESS(x) r->output = x; return 1
 #define MPC_FAILURE(x) r->error = x; return 0
 #define MPC_PRIMITIVE(x) \
   if (x) { MPC_SUCCESS(r->output); } \
   else { MPC_FAILURE(NULL); }
+#define MPC_RUN(x) mpc_parse_push(i, x); return -1
+#define MPC_INSTEAD(x) f->p = x; f->entered = 0; return -1
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+/*
+** Entering and resuming a frame give 1 or 0 for
+** success or failure, with the result in r, or
+** -1 once they have pushed a part to run next.
+*/
+
+static int mpc_parse_enter(mpc_input_t *i, mpc_frame_t *f, mpc_result_t *r) {
   
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  int c, found;
+  mpc_parser_t *p = f->p;
+  
+  f->entered = 1;
+  f->j = 0;
+  f->memo = mpc_input_memo_on(i) && mpc_memo_worth(p);
+  if (f->memo) {
+    found = mpc_input_memo_find(i, p, r);
+    if (found != -1) { return found; }
+  }
   
   switch (p->type) {
       
@@ -1037,48 +1650,141 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     
     /* Application Parsers */
     
+    case MPC_TYPE_APPLY:    MPC_RUN(p->data.apply.x);
+    case MPC_TYPE_APPLY_TO: MPC_RUN(p->data.apply_to.x);
+    
+    /* With errors suppressed an expect adds nothing, so its parser is run in its place */
+    
+    case MPC_TYPE_EXPECT:
+      if (i->suppress > 0) { MPC_INSTEAD(p->data.expect.x); }
+      mpc_input_suppress_enable(i);
+      MPC_RUN(p->data.expect.x);
+    
+    case MPC_TYPE_PREDICT:
+      mpc_input_backtrack_disable(i);
+      MPC_RUN(p->data.predict.x);
+    
+    case MPC_TYPE_PACKRAT:
+      mpc_input_packrat_enable(i);
+      MPC_RUN(p->data.packrat.x);
+    
+    /* The regex parsers are run instead where errors are wanted */
+    
+    case MPC_TYPE_DFA:
+      if (mpc_input_dfa_on(i)) {
+        MPC_PRIMITIVE(mpc_input_dfa(i, &p->data.dfa, (char**)&r->output));
+      }
+      MPC_INSTEAD(p->data.dfa.x);
+    
+    /* Optional Parsers */
+    
+    case MPC_TYPE_NOT:
+      mpc_input_mark(i);
+      mpc_input_suppress_enable(i);
+      MPC_RUN(p->data.not.x);
+    
+    case MPC_TYPE_MAYBE: MPC_RUN(p->data.not.x);
+    
+    /* Repeat Parsers */
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      MPC_RUN(p->data.repeat.x);
+    
+    /* Combinatory Parsers */
+    
+    case MPC_TYPE_OR:
+      
+      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+      
+      f->end = p->data.or.n;
+      f->dispatch = NULL;
+      
+      if (p->data.or.dispatch && mpc_input_dispatch_on(i)) {
+        c = (unsigned char)i->string[i->state.pos];
+        f->dispatch = p->data.or.dispatch;
+        f->j = f->dispatch[c];
+        f->end = f->dispatch[c+1];
+        if (f->j == f->end) {
+          if (f->memo) { mpc_input_memo_fail(i, p, NULL); }
+          MPC_FAILURE(NULL);
+        }
+        MPC_RUN(p->data.or.xs[f->dispatch[f->j]]);
+      }
+      
+      MPC_RUN(p->data.or.xs[0]);
+    
+    case MPC_TYPE_AND:
+      
+      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+      
+      /* Where each part starts, so parts thrown away can be kept in the memo */
+      if (f->memo) {
+        f->starts = mpc_malloc(i, sizeof(mpc_mark_t) * p->data.and.n);
+        f->starts[0].state = i->state;
+        f->starts[0].last = i->last;
+      }
+      
+      mpc_input_mark(i);
+      MPC_RUN(p->data.and.xs[0]);
+    
+    /* End */
+    
+    default:
+      
+      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+  }
+  
+  return 0;
+  
+}
+
+static int mpc_parse_resume(mpc_input_t *i, mpc_frame_t *f, int x, mpc_result_t *r, mpc_err_t **e) {
+  
+  int k;
+  mpc_parser_t *p = f->p;
+  
+  switch (p->type) {
+    
+    /* Application Parsers */
+    
     case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e)) {
+      if (x) {
         MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
       } else {
         MPC_FAILURE(r->output);
       }
     
     case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e)) {
+      if (x) {
         MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
       } else {
         MPC_FAILURE(r->error);
       }
     
     case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e)) {
-        mpc_input_suppress_disable(i);
+      mpc_input_suppress_disable(i);
+      if (x) {
         MPC_SUCCESS(r->output);
       } else {
-        mpc_input_suppress_disable(i);
         MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
       }
     
     case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e)) {      
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
-      }
+      mpc_input_backtrack_enable(i);
+      return x;
+    
+    case MPC_TYPE_PACKRAT:
+      mpc_input_packrat_disable(i);
+      return x;
     
     /* Optional Parsers */
     
     /* TODO: Update Not Error Message */
     
     case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
+      if (x) {
         mpc_input_rewind(i);
         mpc_input_suppress_disable(i);
         mpc_parse_dtor(i, p->data.not.dx, r->output);
@@ -1090,7 +1796,7 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       }
     
     case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
+      if (x) {
         MPC_SUCCESS(r->output);
       } else {
         *e = mpc_err_merge(i, *e, r->error);
@@ -1100,122 +1806,86 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     /* Repeat Parsers */
     
     case MPC_TYPE_MANY:
-      
-      results = results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
-      
-      *e = mpc_err_merge(i, *e, results[j].error);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
     case MPC_TYPE_MANY1:
       
-      results = results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
+      if (x) {
+        mpc_parse_keep(i, r);
+        f->j++;
+        MPC_RUN(p->data.repeat.x);
       }
       
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        *e = mpc_err_merge(i, *e, results[j].error);
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      if (p->type == MPC_TYPE_MANY1 && f->j == 0) {
+        MPC_FAILURE(mpc_err_many1(i, r->error));
       }
+      
+      *e = mpc_err_merge(i, *e, r->error);
+      MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, mpc_parse_kept(i, f)));
     
     case MPC_TYPE_COUNT:
       
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
+      if (x) {
+        mpc_parse_keep(i, r);
+        f->j++;
+        if (f->j != p->data.repeat.n) { MPC_RUN(p->data.repeat.x); }
+      }
       
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
+      if (f->j == p->data.repeat.n) {
+        MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, mpc_parse_kept(i, f)));
       }
       
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });  
+      for (k = 0; k < f->j; k++) {
+        mpc_parse_dtor(i, p->data.repeat.dx, mpc_parse_kept(i, f)[k]);
       }
+      MPC_FAILURE(mpc_err_count(i, r->error, p->data.repeat.n));
       
     /* Combinatory Parsers */
     
     case MPC_TYPE_OR:
       
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+      if (x) { MPC_SUCCESS(r->output); }
       
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+      /* Skipped alternatives give no error, so neither do those run */
+      if (!f->dispatch) { *e = mpc_err_merge(i, *e, r->error); }
       
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
-        } 
+      f->j++;
+      if (f->j < f->end) {
+        MPC_RUN(p->data.or.xs[f->dispatch ? f->dispatch[f->j] : f->j]);
       }
       
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      if (f->memo) { mpc_input_memo_fail(i, p, NULL); }
+      MPC_FAILURE(NULL);
     
     case MPC_TYPE_AND:
       
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
-      
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-      
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e)) {
-          mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
+      if (x) {
+        mpc_parse_keep(i, r);
+        f->j++;
+        if (f->j < p->data.and.n) {
+          if (f->memo) {
+            f->starts[f->j].state = i->state;
+            f->starts[f->j].last = i->last;
           }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+          MPC_RUN(p->data.and.xs[f->j]);
+        }
+        mpc_input_unmark(i);
+        if (f->memo) { mpc_free(i, f->starts); }
+        MPC_SUCCESS(mpc_parse_fold(i, p->data.and.f, f->j, mpc_parse_kept(i, f)));
+      }
+      
+      mpc_input_rewind(i);
+      for (k = 0; k < f->j; k++) {
+        if (f->memo) {
+          mpc_input_memo_stash(i, p->data.and.xs[k], &f->starts[k], &f->starts[k+1],
+            mpc_parse_kept(i, f)[k], p->data.and.dxs[k]);
+        } else {
+          mpc_parse_dtor(i, p->data.and.dxs[k], mpc_parse_kept(i, f)[k]);
         }
       }
-      mpc_input_unmark(i); 
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      if (f->memo) {
+        mpc_input_memo_fail(i, p, r->error);
+        mpc_free(i, f->starts);
+      }
+      MPC_FAILURE(r->error);
     
     /* End */
     
@@ -1224,19 +1894,77 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
   }
   
-  return 0;
-  
+  return 0;
+  
+}
+
+#undef MPC_SUCCESS
+#undef MPC_FAILURE
+#undef MPC_PRIMITIVE
+#undef MPC_RUN
+#undef MPC_INSTEAD
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  int x = 0;
+  int from = i->frames_num;
+  mpc_frame_t *f;
+  
+  mpc_parse_push(i, p);
+  
+  while (i->frames_num > from) {
+    
+    f = &i->frames[i->frames_num-1];
+    x = f->entered
+      ? mpc_parse_resume(i, f, x, r, e)
+      : mpc_parse_enter(i, f, r);
+    
+    if (x == -1) { continue; }
+    
+    /* Done, so it is popped and the frame below resumed with r */
+    i->results_num = f->base;
+    i->frames_num--;
+  }
+  
+  return x;
 }
 
-#undef MPC_SUCCESS
-#undef MPC_FAILURE
-#undef MPC_PRIMITIVE
+/*
+** Input held in memory is parsed with errors
+** suppressed first, which lets alternatives be
+** skipped and regexes run as a DFA. Only if that
+** fails is it parsed again to find the errors.
+*/
+
+static int mpc_parse_quick(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_err_t *e = NULL;
+  mpc_input_suppress_enable(i);
+  x = mpc_parse_run(i, p, r, &e);
+  mpc_input_suppress_disable(i);
+  if (i->memo_num > 0) { mpc_input_memo_purge(i, 1); }
+  return x;
+}
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
+  mpc_err_t *e;
+  mpc_state_t state = i->state;
+  char last = i->last;
+  
+  if (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP) {
+    if (mpc_parse_quick(i, p, r)) {
+      r->output = mpc_export(i, r->output);
+      return 1;
+    }
+    i->state = state;
+    i->last = last;
+  }
+  
+  e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
   x = mpc_parse_run(i, p, r, &e);
+  if (i->memo_num > 0) { mpc_input_memo_purge(i, 1); }
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
@@ -1280,9 +2008,20 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
 
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
   
-  FILE *f = fopen(filename, "rb");
+  FILE *f;
   int res;
   
+#ifdef MPC_MMAP
+  /* Parse the file in place if it can be mapped */
+  mpc_input_t *i = mpc_input_new_mmap(filename);
+  if (i) {
+    res = mpc_parse_input(i, p, r);
+    mpc_input_delete(i);
+    return res;
+  }
+#endif
+  
+  f = fopen(filename, "rb");
   if (f == NULL) {
     r->output = NULL;
     r->error = mpc_err_file(filename, "Unable to open file!");
@@ -1307,6 +2046,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  free(p->data.or.dispatch);
   
 }
 
@@ -1338,6 +2078,13 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_PACKRAT:  mpc_undefine_unretained(p->data.packrat.x, 0);  break;
+    
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      free(p->data.dfa.accept);
+      free(p->data.dfa.trans);
+      break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1436,6 +2183,15 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_PACKRAT:  p->data.packrat.x  = mpc_copy(a->data.packrat.x);  break;
+    
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.accept = malloc(a->data.dfa.n);
+      memcpy(p->data.dfa.accept, a->data.dfa.accept, a->data.dfa.n);
+      p->data.dfa.trans = malloc(a->data.dfa.n * 256 * sizeof(int));
+      memcpy(p->data.dfa.trans, a->data.dfa.trans, a->data.dfa.n * 256 * sizeof(int));
+      break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1459,6 +2215,10 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      if (a->data.or.dispatch) {
+        p->data.or.dispatch = malloc(a->data.or.dispatch[256] * sizeof(int));
+        memcpy(p->data.or.dispatch, a->data.or.dispatch, a->data.or.dispatch[256] * sizeof(int));
+      }
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1726,6 +2486,13 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_packrat(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PACKRAT;
+  p->data.packrat.x = a;
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -1787,6 +2554,7 @@ mpc_parser_t *mpc_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.dispatch = NULL;
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -2156,6 +2924,359 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+/*
+** Regex DFA
+**
+** The parsers built for a regex try each choice
+** and repetition in turn, copying out a string
+** for every char they match. Where these always
+** end up taking the longest match they can, the
+** regex is compiled to a DFA with a transition
+** table over all 256 chars and run in a loop.
+**
+** This holds when no part of it can stop where
+** what comes after could go on. That is worked
+** out from the chars each part can start with
+** and be continued by. Other regexes, such as
+** "a*a", keep their parsers. So do the parts of
+** them that would qualify, as a failing regex
+** gives the errors of all its parts.
+*/
+
+enum {
+  MPC_DFA_POS_MAX    = 256,
+  MPC_DFA_STATES_MAX = 256
+};
+
+typedef struct {
+  int nullable;
+  int min, max, size;
+  unsigned char first[32];
+  unsigned char cont[32];
+} mpc_re_info_t;
+
+typedef struct {
+  int num;
+  unsigned char chars[MPC_DFA_POS_MAX][32];
+  unsigned char follow[MPC_DFA_POS_MAX][32];
+} mpc_nfa_t;
+
+static int mpc_re_set_has(const unsigned char *x, int c) {
+  return (x[c >> 3] >> (c & 7)) & 1;
+}
+
+static void mpc_re_set_add(unsigned char *x, int c) {
+  x[c >> 3] |= (unsigned char)(1 << (c & 7));
+}
+
+static void mpc_re_set_union(unsigned char *x, const unsigned char *y) {
+  int j;
+  for (j = 0; j < 32; j++) { x[j] |= y[j]; }
+}
+
+static int mpc_re_set_meets(const unsigned char *x, const unsigned char *y) {
+  int j;
+  for (j = 0; j < 32; j++) { if (x[j] & y[j]) { return 1; } }
+  return 0;
+}
+
+/* Chars a single char parser matches, tested as the input does */
+static int mpc_re_chars(mpc_parser_t *p, unsigned char *x) {
+
+  int c;
+  char y;
+
+  if (p->type != MPC_TYPE_ANY    && p->type != MPC_TYPE_SINGLE
+  &&  p->type != MPC_TYPE_ONEOF  && p->type != MPC_TYPE_NONEOF
+  &&  p->type != MPC_TYPE_RANGE) { return 0; }
+
+  memset(x, 0, 32);
+  for (c = 0; c < 256; c++) {
+    y = (char)c;
+    if ((p->type == MPC_TYPE_ANY)
+    ||  (p->type == MPC_TYPE_SINGLE && y == p->data.single.x)
+    ||  (p->type == MPC_TYPE_ONEOF  && strchr(p->data.string.x, y) != 0)
+    ||  (p->type == MPC_TYPE_NONEOF && strchr(p->data.string.x, y) == 0)
+    ||  (p->type == MPC_TYPE_RANGE  && y >= p->data.range.x && y <= p->data.range.y)) {
+      mpc_re_set_add(x, c);
+    }
+  }
+
+  return 1;
+}
+
+/* Take the longest match of n and then of m */
+static int mpc_re_info_and(mpc_re_info_t *n, mpc_re_info_t *m) {
+
+  if (mpc_re_set_meets(n->cont, m->first)) { return 0; }
+
+  if (n->nullable) { mpc_re_set_union(n->first, m->first); }
+  if (m->nullable) { mpc_re_set_union(n->cont, m->cont); }
+  else             { memcpy(n->cont, m->cont, 32); }
+
+  n->nullable = n->nullable && m->nullable;
+  n->min  = n->min + m->min;
+  n->max  = n->max < 0 || m->max < 0 ? -1 : n->max + m->max;
+  n->size = n->size + m->size;
+  return 1;
+}
+
+/* Take n, or m if n fails, when that is also the longer */
+static int mpc_re_info_or(mpc_re_info_t *n, mpc_re_info_t *m) {
+
+  int overlap = mpc_re_set_meets(n->first, m->first);
+
+  if ((n->nullable || overlap)
+  &&  (m->max < 0 || n->min < m->max)) { return 0; }
+
+  /* Something m matches may be the start of something longer n does */
+  mpc_re_set_union(n->cont, m->cont);
+  if (overlap) { memset(n->cont, 0xFF, 32); }
+  if (m->nullable) { mpc_re_set_union(n->cont, n->first); }
+  mpc_re_set_union(n->first, m->first);
+
+  n->nullable = n->nullable || m->nullable;
+  n->min  = n->min < m->min ? n->min : m->min;
+  n->max  = n->max < 0 || m->max < 0 ? -1 : (n->max > m->max ? n->max : m->max);
+  n->size = n->size + m->size;
+  return 1;
+}
+
+/* Repeat n, each time taking its longest match */
+static int mpc_re_info_repeat(mpc_re_info_t *n) {
+  if (n->nullable || mpc_re_set_meets(n->cont, n->first)) { return 0; }
+  mpc_re_set_union(n->cont, n->first);
+  return 1;
+}
+
+/*
+** Fills in what is known about the regex parser
+** p, returning 0 if it is not one that always
+** takes its longest match, or is too large.
+*/
+
+static int mpc_re_info(mpc_parser_t *p, mpc_re_info_t *n) {
+
+  int j;
+  mpc_re_info_t m;
+
+  if (mpc_re_chars(p, n->first)) {
+    n->nullable = 0;
+    n->min = n->max = n->size = 1;
+    memset(n->cont, 0, 32);
+    return 1;
+  }
+
+  switch (p->type) {
+
+    case MPC_TYPE_LIFT:
+      if (p->data.lift.lf != mpcf_ctor_str) { return 0; }
+      n->nullable = 1;
+      n->min = n->max = n->size = 0;
+      memset(n->first, 0, 32);
+      memset(n->cont, 0, 32);
+      return 1;
+
+    case MPC_TYPE_EXPECT:
+      return mpc_re_info(p->data.expect.x, n);
+
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold
+      || !mpc_re_info(p->data.and.xs[0], n)) { return 0; }
+      for (j = 1; j < p->data.and.n; j++) {
+        if (!mpc_re_info(p->data.and.xs[j], &m)
+        ||  !mpc_re_info_and(n, &m)) { return 0; }
+      }
+      break;
+
+    case MPC_TYPE_OR:
+      if (!mpc_re_info(p->data.or.xs[0], n)) { return 0; }
+      for (j = 1; j < p->data.or.n; j++) {
+        if (!mpc_re_info(p->data.or.xs[j], &m)
+        ||  !mpc_re_info_or(n, &m)) { return 0; }
+      }
+      break;
+
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str
+      || !mpc_re_info(p->data.not.x, n)) { return 0; }
+      mpc_re_set_union(n->cont, n->first);
+      n->nullable = 1;
+      n->min = 0;
+      break;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      if (p->data.repeat.f != mpcf_strfold
+      || !mpc_re_info(p->data.repeat.x, n)
+      || !mpc_re_info_repeat(n)) { return 0; }
+      if (p->type == MPC_TYPE_MANY) {
+        n->nullable = 1;
+        n->min = 0;
+      }
+      n->max = -1;
+      break;
+
+    /*
+    ** A count failing part way does not give back
+    ** what it matched, and one of none fails where
+    ** its parser would match.
+    */
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f != mpcf_strfold
+      ||  p->data.repeat.n != 1
+      || !mpc_re_info(p->data.repeat.x, n)) { return 0; }
+      break;
+
+    default: return 0;
+  }
+
+  return n->size <= MPC_DFA_POS_MAX;
+}
+
+/*
+** The NFA has a position for each single char
+** parser, with the positions that can follow
+** it. Sets of positions are bit sets the same
+** as sets of chars.
+*/
+
+static void mpc_nfa_follow(mpc_nfa_t *a, const unsigned char *x, const unsigned char *y) {
+  int j;
+  for (j = 0; j < a->num; j++) {
+    if (mpc_re_set_has(x, j)) { mpc_re_set_union(a->follow[j], y); }
+  }
+}
+
+static int mpc_nfa_build(mpc_nfa_t *a, mpc_parser_t *p, unsigned char *first, unsigned char *last) {
+
+  int j, n, k, nullable;
+  mpc_parser_t *x;
+  unsigned char f[32], l[32];
+
+  memset(first, 0, 32);
+  memset(last, 0, 32);
+
+  if (mpc_re_chars(p, a->chars[a->num])) {
+    mpc_re_set_add(first, a->num);
+    mpc_re_set_add(last, a->num);
+    a->num++;
+    return 0;
+  }
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT: return mpc_nfa_build(a, p->data.expect.x, first, last);
+    case MPC_TYPE_MAYBE: mpc_nfa_build(a, p->data.not.x, first, last); return 1;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      nullable = mpc_nfa_build(a, p->data.repeat.x, first, last);
+      mpc_nfa_follow(a, last, first);
+      return p->type == MPC_TYPE_MANY ? 1 : nullable;
+
+    case MPC_TYPE_OR:
+      nullable = 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        nullable = mpc_nfa_build(a, p->data.or.xs[j], f, l) || nullable;
+        mpc_re_set_union(first, f);
+        mpc_re_set_union(last, l);
+      }
+      return nullable;
+
+    case MPC_TYPE_AND:
+    case MPC_TYPE_COUNT:
+      n = p->type == MPC_TYPE_AND ? p->data.and.n : p->data.repeat.n;
+      nullable = 1;
+      for (j = 0; j < n; j++) {
+        x = p->type == MPC_TYPE_AND ? p->data.and.xs[j] : p->data.repeat.x;
+        k = mpc_nfa_build(a, x, f, l);
+        mpc_nfa_follow(a, last, f);
+        if (nullable) { mpc_re_set_union(first, f); }
+        if (k) { mpc_re_set_union(last, l); }
+        else   { memcpy(last, l, 32); }
+        nullable = nullable && k;
+      }
+      return nullable;
+
+    default: return 1;
+  }
+}
+
+/*
+** Each DFA state is the set of positions that
+** can come next, and whether it accepts. State
+** 0 is dead and 1 is the start.
+*/
+
+static int mpc_dfa_build(mpc_pdata_dfa_t *d, mpc_parser_t *p) {
+
+  int s, c, j, t;
+  mpc_nfa_t *a = calloc(1, sizeof(mpc_nfa_t));
+  unsigned char (*sets)[32] = calloc(MPC_DFA_STATES_MAX, 32);
+  unsigned char last[32], matched[32], next[32];
+  char accept;
+
+  d->n = 2;
+  d->accept = calloc(MPC_DFA_STATES_MAX, 1);
+  d->trans = calloc(MPC_DFA_STATES_MAX * 256, sizeof(int));
+  d->accept[1] = (char)mpc_nfa_build(a, p, sets[1], last);
+
+  for (s = 1; s < d->n; s++) {
+    for (c = 0; c < 256; c++) {
+
+      memset(matched, 0, 32);
+      memset(next, 0, 32);
+      for (j = 0; j < a->num; j++) {
+        if (mpc_re_set_has(sets[s], j) && mpc_re_set_has(a->chars[j], c)) {
+          mpc_re_set_add(matched, j);
+          mpc_re_set_union(next, a->follow[j]);
+        }
+      }
+
+      accept = (char)mpc_re_set_meets(matched, last);
+      for (t = 0; t < d->n; t++) {
+        if (d->accept[t] == accept && memcmp(sets[t], next, 32) == 0) { break; }
+      }
+
+      if (t == d->n) {
+        if (d->n == MPC_DFA_STATES_MAX) {
+          free(a); free(sets);
+          free(d->accept); free(d->trans);
+          return 0;
+        }
+        memcpy(sets[t], next, 32);
+        d->accept[t] = accept;
+        d->n++;
+      }
+
+      d->trans[s * 256 + c] = t;
+    }
+  }
+
+  d->accept = realloc(d->accept, d->n);
+  d->trans = realloc(d->trans, d->n * 256 * sizeof(int));
+  free(a); free(sets);
+  return 1;
+}
+
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *p) {
+
+  mpc_re_info_t n;
+  mpc_parser_t *q;
+
+  /* A single char is as quick to match as it is */
+  if (!mpc_re_info(p, &n) || (n.size <= 1 && n.max >= 0 && n.max <= 1)) { return p; }
+
+  q = mpc_undefined();
+  q->type = MPC_TYPE_DFA;
+  q->data.dfa.x = p;
+  if (mpc_dfa_build(&q->data.dfa, p)) { return q; }
+
+  free(q);
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
   
   char *err_msg;
@@ -2219,7 +3340,7 @@ mpc_parser_t *mpc_re(const char *re) {
   
   mpc_optimise(r.output);
   
-  return r.output;
+  return mpc_re_dfa(r.output);
   
 }
 
@@ -2560,6 +3681,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_print_unretained(p->data.packrat.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { mpc_print_unretained(p->data.dfa.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2665,20 +3788,32 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 ** AST
 */
 
+/* Children waiting to be deleted go on a stack, so however deep the tree is it does not recurse */
 void mpc_ast_delete(mpc_ast_t *a) {
   
-  int i;
-  
-  if (a == NULL) { return; }
+  int i, n = 0, slots = 0;
+  mpc_ast_t **stk = NULL;
   
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_delete(a->children[i]);
+  while (a != NULL) {
+    
+    if (n + a->children_num > slots) {
+      slots = (n + a->children_num) * 2;
+      stk = realloc(stk, sizeof(mpc_ast_t*) * slots);
+    }
+    
+    for (i = 0; i < a->children_num; i++) {
+      if (a->children[i]) { stk[n++] = a->children[i]; }
+    }
+    
+    free(a->children);
+    free(a->tag);
+    free(a->contents);
+    free(a);
+    
+    a = n > 0 ? stk[--n] : NULL;
   }
   
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
+  free(stk);
   
 }
 
@@ -3076,6 +4211,7 @@ mpc_parser_t *mpca_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.dispatch = NULL;
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -3349,6 +4485,7 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
   
   mpc_optimise(r.output);
   
+  if (st->flags & MPCA_LANG_PACKRAT) { r.output = mpc_packrat(r.output); }
   return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
   
 }
@@ -3428,6 +4565,7 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     stmt = *stmts;
     left = mpca_grammar_find_parser(stmt->ident, st);
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
+    if (st->flags & MPCA_LANG_PACKRAT)    { stmt->grammar = mpc_packrat(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
@@ -3623,6 +4761,8 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { return 1 + mpc_nodecount_unretained(p->data.packrat.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
@@ -3657,6 +4797,144 @@ void mpc_stats(mpc_parser_t* p) {
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
 }
 
+/*
+** The chars a parser can start by consuming go
+** in x, returning 1 if it may also succeed with
+** consuming nothing. Rules not defined yet, or
+** met again through recursion, could start with
+** anything, as could parsers nested too deep.
+*/
+
+enum { MPC_FIRST_DEPTH_MAX = 64 };
+
+typedef struct mpc_first_t {
+  mpc_parser_t *p;
+  struct mpc_first_t *up;
+} mpc_first_t;
+
+static int mpc_first(mpc_parser_t *p, unsigned char *x, mpc_first_t *up, int depth) {
+
+  int j, e;
+  unsigned char y[32];
+  mpc_first_t v, *w;
+
+  memset(x, 0, 32);
+
+  for (w = up; w; w = w->up) {
+    if (w->p == p) { depth = MPC_FIRST_DEPTH_MAX; }
+  }
+
+  if (depth >= MPC_FIRST_DEPTH_MAX) {
+    memset(x, 0xFF, 32);
+    return 1;
+  }
+
+  if (mpc_re_chars(p, x)) { return 0; }
+
+  v.p = p;
+  v.up = up;
+  depth++;
+
+  switch (p->type) {
+
+    case MPC_TYPE_FAIL: return 0;
+
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_NOT:
+      return 1;
+
+    case MPC_TYPE_SATISFY:
+      memset(x, 0xFF, 32);
+      return 0;
+
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return 1; }
+      mpc_re_set_add(x, (unsigned char)p->data.string.x[0]);
+      return 0;
+
+    case MPC_TYPE_EXPECT:   return mpc_first(p->data.expect.x, x, &v, depth);
+    case MPC_TYPE_APPLY:    return mpc_first(p->data.apply.x, x, &v, depth);
+    case MPC_TYPE_APPLY_TO: return mpc_first(p->data.apply_to.x, x, &v, depth);
+    case MPC_TYPE_PREDICT:  return mpc_first(p->data.predict.x, x, &v, depth);
+    case MPC_TYPE_PACKRAT:  return mpc_first(p->data.packrat.x, x, &v, depth);
+    case MPC_TYPE_DFA:      return mpc_first(p->data.dfa.x, x, &v, depth);
+
+    case MPC_TYPE_MAYBE: mpc_first(p->data.not.x, x, &v, depth); return 1;
+    case MPC_TYPE_MANY:  mpc_first(p->data.repeat.x, x, &v, depth); return 1;
+    case MPC_TYPE_MANY1: return mpc_first(p->data.repeat.x, x, &v, depth);
+
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.n == 0) { return 1; }
+      return mpc_first(p->data.repeat.x, x, &v, depth);
+
+    case MPC_TYPE_OR:
+      e = p->data.or.n == 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        e = mpc_first(p->data.or.xs[j], y, &v, depth) || e;
+        mpc_re_set_union(x, y);
+      }
+      return e;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        e = mpc_first(p->data.and.xs[j], y, &v, depth);
+        mpc_re_set_union(x, y);
+        if (!e) { return 0; }
+      }
+      return 1;
+
+    default:
+      memset(x, 0xFF, 32);
+      return 1;
+  }
+}
+
+/*
+** For each char, the alternatives of an `or`
+** that might match starting with it. Offsets
+** into the table come first, one for each char
+** and one for the end.
+*/
+
+static void mpc_optimise_dispatch(mpc_parser_t *p) {
+
+  int j, c, k, num = 0;
+  int n = p->data.or.n;
+  unsigned char (*firsts)[32] = malloc(32 * (n > 0 ? n : 1));
+  int *d;
+
+  free(p->data.or.dispatch);
+  p->data.or.dispatch = NULL;
+
+  for (j = 0; j < n; j++) {
+    if (mpc_first(p->data.or.xs[j], firsts[j], NULL, 0)) { memset(firsts[j], 0xFF, 32); }
+    for (c = 0; c < 256; c++) { num += mpc_re_set_has(firsts[j], c); }
+  }
+
+  /* Not worth it if no alternative can be skipped */
+  if (num == 256 * n) {
+    free(firsts);
+    return;
+  }
+
+  d = malloc((257 + num) * sizeof(int));
+  k = 257;
+  for (c = 0; c < 256; c++) {
+    d[c] = k;
+    for (j = 0; j < n; j++) {
+      if (mpc_re_set_has(firsts[j], c)) { d[k++] = j; }
+    }
+  }
+  d[256] = k;
+
+  p->data.or.dispatch = d;
+  free(firsts);
+}
+
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   
   int i, n, m;
@@ -3670,6 +4948,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_optimise_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_optimise_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_optimise_unretained(p->data.packrat.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { mpc_optimise_unretained(p->data.dfa.x, 0); }
   if (p->type == MPC_TYPE_NOT)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)    { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)     { mpc_optimise_unretained(p->data.repeat.x, 0); }
@@ -3701,7 +4981,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.dispatch); free(t->name); free(t);
       continue;
     }
 
@@ -3713,9 +4993,9 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       n = p->data.or.n; m = t->data.or.n;
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      memmove(p->data.or.xs + m, t->data.or.xs + 1, n * sizeof(mpc_parser_t*));
+      memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.dispatch); free(t->name); free(t);
       continue;
     }
     
@@ -3818,10 +5098,12 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
     
-    return;
+    break;
     
   }
   
+  if (p->type == MPC_TYPE_OR) { mpc_optimise_dispatch(p); }
+  
 }
 
 void mpc_optimise(mpc_parser_t *p) {
@@ -6,6 +6,8 @@
 #include "lenv.h"
 #include "lval.h"
 #include "rok.h"
+#include "lgc.h"
+#include "lread.h"
 
 /* If we are compiling on Windows compile these functions */
 #ifdef _WIN32
@@ -31,6 +33,17 @@ void add_history(char* unused) {}
 #include <editline/readline.h>
 #endif
 
+/* Parsers for the -DROK_MPC reader, declared in rok.h */
+mpc_parser_t* Number;
+mpc_parser_t* Boolean;
+mpc_parser_t* Symbol;
+mpc_parser_t* String;
+mpc_parser_t* Comment;
+mpc_parser_t* Sexpr;
+mpc_parser_t* Qexpr;
+mpc_parser_t* Expr;
+mpc_parser_t* Rok;
+
 char* check_filename_ext(char* filename) {
   char* dot = strchr(filename, '.');
   if (!dot || dot == filename) return "Wrong file type. Please use .rok extension.";
@@ -39,6 +52,7 @@ char* check_filename_ext(char* filename) {
 }
 
 int main(int argc, char** argv) {
+#ifdef ROK_MPC
   /* Create some parsers */
   Number   = mpc_new("number");
   Boolean  = mpc_new("boolean");
@@ -63,6 +77,7 @@ int main(int argc, char** argv) {
                  <string> | <comment> | <sexpr> | <qexpr> ;"
     " rok      : /^/ <expr>* /$/ ;                         ",
     Number, Boolean, Symbol, String, Comment, Sexpr, Qexpr, Expr, Rok);
+#endif
 
   lenv* env = lenv_new();
   lenv_add_builtins(env);
@@ -86,18 +101,18 @@ int main(int argc, char** argv) {
         /* Add input to history */
         add_history(input);
 
-        /* Attempt to parse the user Input */
-        mpc_result_t result;
-        if (mpc_parse("<stdin>", input, Rok, &result)) {
-          /* On Success Print the AST */
-          lval* x = lval_eval(env, lval_read(result.output));
+        /* Attempt to read the user Input */
+        lval* expr = lread_string("<stdin>", input);
+        if (lval_type(expr) != LVAL_ERR) {
+          /* On Success evaluate and print the result */
+          lval* x = lval_eval(env, expr);
           lval_println(x);
           lval_del(x);
-          mpc_ast_delete(result.output);
+          lgc_safe_point(env);
         } else {
           /* Otherwise print the error */
-          mpc_err_print(result.error);
-          mpc_err_delete(result.error);
+          lval_println(expr);
+          lval_del(expr);
         }
 
         /* Free retrieved input */
@@ -115,23 +130,25 @@ int main(int argc, char** argv) {
         lval_del(err);
         return 0;
       }
-      lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
-
       lval* standard = lval_add(lval_sexpr(), lval_str("standard.rok"));
       lval* load = builtin_load(env, standard);
       lval_del(load);
 
       /* Load and get result */
+      lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
       lval* x = builtin_load(env, args);
 
       /* If the result is an error print it */
-      if (x->type == LVAL_ERR) { lval_println(x); }
+      if (lval_type(x) == LVAL_ERR) { lval_println(x); }
       lval_del(x);
     }
   }
 
-  /* Undefine and Delete our Parsers */
   lenv_del(env);
+
+#ifdef ROK_MPC
+  /* Undefine and Delete our Parsers */
   mpc_cleanup(9, Number, Boolean, Symbol, String, Comment, Sexpr, Qexpr, Expr, Rok);
+#endif
   return 0;
 }
@@ -4,14 +4,14 @@
 #include "mpc.h"
 
 /* Parser Declarations */
-mpc_parser_t* Number;
-mpc_parser_t* Boolean;
-mpc_parser_t* Symbol;
-mpc_parser_t* String;
-mpc_parser_t* Comment;
-mpc_parser_t* Sexpr;
-mpc_parser_t* Qexpr;
-mpc_parser_t* Expr;
-mpc_parser_t* Rok;
+extern mpc_parser_t* Number;
+extern mpc_parser_t* Boolean;
+extern mpc_parser_t* Symbol;
+extern mpc_parser_t* String;
+extern mpc_parser_t* Comment;
+extern mpc_parser_t* Sexpr;
+extern mpc_parser_t* Qexpr;
+extern mpc_parser_t* Expr;
+extern mpc_parser_t* Rok;
 
 #endif
@@ -0,0 +1,152 @@
+/*
+** Checks of the mpc changes Rok's own scripts cannot reach. Built and
+** run by make test, prints each failure and exits nonzero if any.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../mpc.h"
+
+static int failures = 0;
+
+static int streq(const void* a, const void* b) { return strcmp(a, b) == 0; }
+static void strprint(const void* a) { printf("'%s'", (char*)a); }
+
+static void check(int ok, char* what) {
+  if (!ok) {
+    printf("FAIL mpc %s\n", what);
+    failures++;
+  }
+}
+
+/* Parse with p and compare the output, or the error, with expected */
+static void check_parse(mpc_parser_t* p, char* input, size_t length, char* expected, char* what) {
+  mpc_result_t r;
+  char* got;
+  if (mpc_nparse("<test>", input, length, p, &r)) {
+    got = r.output;
+  } else {
+    got = mpc_err_string(r.error);
+    mpc_err_delete(r.error);
+  }
+  if (strcmp(got, expected) != 0) {
+    printf("FAIL mpc %s\n  got      %s\n  expected %s\n", what, got, expected);
+    failures++;
+  }
+  free(got);
+}
+
+/* String input is borrowed, and nparse stops at the length given */
+static void test_nparse(void) {
+  mpc_parser_t* p = mpc_many(mpcf_strfold, mpc_alpha());
+  char buffer[] = "abcdef";
+
+  check_parse(p, buffer, 3, "abc", "nparse length");
+  check_parse(p, "ab\0cd", 5, "ab", "nparse stops at null");
+  check(strcmp(buffer, "abcdef") == 0, "nparse leaves input alone");
+
+  mpc_delete(p);
+}
+
+/* Packrat mode gives the same trees and errors as the default mode */
+static void test_packrat(void) {
+  mpc_parser_t* expr[2];
+  mpc_parser_t* term[2];
+  mpc_parser_t* fact[2];
+  int flags[2] = { MPCA_LANG_DEFAULT, MPCA_LANG_PACKRAT };
+
+  for (int i = 0; i < 2; i++) {
+    expr[i] = mpc_new("expr");
+    term[i] = mpc_new("term");
+    fact[i] = mpc_new("fact");
+    mpca_lang(flags[i],
+      " expr : <term> '+' <expr> | <term> '-' <expr> | <term> ;     "
+      " term : <fact> '*' <term> | <fact> '/' <term> | <fact> ;     "
+      " fact : /[0-9]+/ | '(' <expr> ')' | '[' <expr> ']' ;         ",
+      expr[i], term[i], fact[i], NULL);
+  }
+
+  char* inputs[] = { "1", "1+2*3", "((((((1+2)*3)-4)/5)+6)*7)", "[(1+[2*(3)])]-4", "(1+2", "1+*2" };
+  for (size_t n = 0; n < sizeof(inputs) / sizeof(inputs[0]); n++) {
+    mpc_result_t r[2];
+    int ok[2];
+    for (int i = 0; i < 2; i++) { ok[i] = mpc_parse("<test>", inputs[n], expr[i], &r[i]); }
+
+    if (ok[0] != ok[1]) {
+      check(0, "packrat agrees on success");
+    } else if (ok[0]) {
+      check(mpc_ast_eq(r[0].output, r[1].output), "packrat tree");
+    } else {
+      char* e0 = mpc_err_string(r[0].error);
+      char* e1 = mpc_err_string(r[1].error);
+      check(strcmp(e0, e1) == 0, "packrat error");
+      free(e0); free(e1);
+    }
+    for (int i = 0; i < 2; i++) {
+      if (ok[i]) { mpc_ast_delete(r[i].output); } else { mpc_err_delete(r[i].error); }
+    }
+  }
+
+  for (int i = 0; i < 2; i++) { mpc_cleanup(3, expr[i], term[i], fact[i]); }
+}
+
+/* Regexes run as a DFA give the same longest match as their parsers */
+static void test_re(void) {
+  mpc_parser_t* sym = mpc_re("[a-z_][a-z0-9_]*");
+  mpc_parser_t* comment = mpc_re(";[^\\r\\n]*");
+  mpc_parser_t* alt = mpc_re("ab|abc|a");
+  mpc_parser_t* num = mpc_re("-?[0-9]+\\.?[0-9]*");
+
+  check(mpc_test_pass(sym, "foo_1 bar", "foo_1", streq, free, strprint), "re symbol");
+  check(mpc_test_fail(sym, "1foo", "", streq, free, strprint), "re symbol start");
+  check(mpc_test_pass(comment, "; a comment\nrest", "; a comment", streq, free, strprint), "re comment");
+  check(mpc_test_pass(comment, ";", ";", streq, free, strprint), "re comment at end");
+  check(mpc_test_pass(alt, "abcd", "ab", streq, free, strprint), "re ordered choice");
+  check(mpc_test_pass(num, "-12.5x", "-12.5", streq, free, strprint), "re number");
+  check_parse(sym, "9", 1, "<test>:1:1: error: expected one of 'abcdefghijklmnopqrstuvwxyz_' at '9'\n", "re error");
+
+  mpc_delete(sym); mpc_delete(comment); mpc_delete(alt); mpc_delete(num);
+}
+
+/* Alternatives skipped by first char dispatch still show in errors */
+static void test_or(void) {
+  mpc_parser_t* p = mpc_or(3, mpc_string("ab"), mpc_string("ac"), mpc_string("b"));
+  mpc_optimise(p);
+
+  check(mpc_test_pass(p, "ac", "ac", streq, free, strprint), "or second of shared first char");
+  check(mpc_test_pass(p, "b", "b", streq, free, strprint), "or last");
+  check_parse(p, "x", 1, "<test>:1:1: error: expected \"ab\", \"ac\" or \"b\" at 'x'\n", "or error");
+  check_parse(p, "ax", 2, "<test>:1:1: error: expected \"ab\", \"ac\" or \"b\" at 'a'\n", "or error after prefix");
+
+  mpc_delete(p);
+}
+
+/* Holding many results at once spills past the inline scratch slots */
+static void test_scratch(void) {
+  size_t length = 200000;
+  char* input = malloc(length + 1);
+  memset(input, 'a', length);
+  input[length] = '\0';
+
+  mpc_parser_t* p = mpc_many(mpcf_strfold, mpc_char('a'));
+  mpc_result_t r;
+  if (mpc_parse("<test>", input, p, &r)) {
+    check(strlen(r.output) == length, "scratch many length");
+    free(r.output);
+  } else {
+    check(0, "scratch many parses");
+    mpc_err_delete(r.error);
+  }
+
+  mpc_delete(p);
+  free(input);
+}
+
+int main(void) {
+  test_nparse();
+  test_packrat();
+  test_re();
+  test_or();
+  test_scratch();
+  return failures != 0;
+}
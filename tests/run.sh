@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Run every tests/*.rok with each Rok binary given, from the top of the
+# tree so standard.rok is found. A script with a tests/NAME.out file must
+# print exactly that, or tests/NAME.mpc.out for a binary whose name ends
+# in _mpc when the mpc reader words it differently. Any other script
+# must print true for every check. Scripts starting with "; vm only" go
+# deeper than the tree walker can and are skipped for *_tree_walk builds.
+#
+
+status=0
+for bin in "$@"; do
+  for test in tests/*.rok; do
+    name=${test%.rok}
+    case $bin in
+      *_tree_walk) if head -1 "$test" | grep -q '^; vm only'; then continue; fi ;;
+    esac
+
+    out=$("$bin" "$test" 2>&1)
+    code=$?
+    if [ $code != 0 ]; then
+      echo "FAIL $bin $test exited with $code"
+      status=1
+      continue
+    fi
+
+    expected=
+    if [ -f "$name.out" ]; then expected=$name.out; fi
+    case $bin in
+      *_mpc) if [ -f "$name.mpc.out" ]; then expected=$name.mpc.out; fi ;;
+    esac
+
+    if [ -n "$expected" ]; then
+      if ! printf '%s\n' "$out" | diff "$expected" - > /dev/null; then
+        echo "FAIL $bin $test"
+        printf '%s\n' "$out" | diff "$expected" - | head -20
+        status=1
+      fi
+    elif printf '%s\n' "$out" | grep -qv '^true $'; then
+      echo "FAIL $bin $test"
+      printf '%s\n' "$out" | grep -nv '^true $' | head -20
+      status=1
+    fi
+  done
+done
+
+[ $status = 0 ] && echo "All tests passed"
+exit $status